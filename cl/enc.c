@@ -12,6 +12,13 @@ static struct {
     AVStream* st;
 } enc_state;
 
+// the release of the pixels handed to enc, kept with each buffer since the
+// encoder may hold several frames
+struct enc_buffer {
+    void (*release)(void*);
+    void* opaque;
+};
+
 static void dump_pkt()
 {
     trace("pts:%s pts_time:%s dts:%s dts_time:%s duration:%s duration_time:%s stream_index:%d",
@@ -21,7 +28,7 @@ static void dump_pkt()
          enc_state.pkt->stream_index);
 }
 
-color_t* enc_initialize(size_t width, size_t height, size_t fps, const char* fn)
+void enc_initialize(size_t width, size_t height, size_t fps, const char* fn)
 {
     // codec
     const char* codec_name = "libx264rgb";
@@ -54,18 +61,9 @@ color_t* enc_initialize(size_t width, size_t height, size_t fps, const char* fn)
     r = avcodec_open2(enc_state.cc, codec, NULL);
     if(r < 0) { failwith("unable to open codec"); }
 
-    // frame
+    // frame, its pixels are handed over by enc
     enc_state.frame = av_frame_alloc();
     if(!enc_state.frame) { failwith("unable to allocate frame"); }
-    enc_state.frame->format = enc_state.cc->pix_fmt;
-    enc_state.frame->width = width;
-    enc_state.frame->height = height;
-
-    r = av_frame_get_buffer(enc_state.frame, 0);
-    if(r < 0) { failwith("av_frame_get_buffer failed"); }
-
-    r = av_frame_make_writable(enc_state.frame);
-    if(r < 0) { failwith("av_frame_make_writable failed"); }
 
     enc_state.pkt = av_packet_alloc();
     if(!enc_state.pkt) { failwith("unable to allocate packet"); }
@@ -85,8 +83,6 @@ color_t* enc_initialize(size_t width, size_t height, size_t fps, const char* fn)
 
     r = avformat_write_header(enc_state.fc, NULL);
     if(r < 0) { failwith("unable to write header: %s", av_err2str(r)); }
-
-    return (color_t*)enc_state.frame->data[0];
 }
 
 static void send_frame(AVFrame* frame)
@@ -115,10 +111,38 @@ static void send_frame(AVFrame* frame)
     }
 }
 
-void enc(size_t i)
+static void enc_release(void* opaque, uint8_t* data)
+{
+    (void)data;
+    struct enc_buffer* b = opaque;
+    b->release(b->opaque);
+    free(b);
+}
+
+// encodes the pixels by reference: release(opaque) is called when the
+// encoder no longer needs them, which may be a few frames later
+void enc(size_t i, const color_t* px, void (*release)(void*), void* opaque)
 {
-    enc_state.frame->pts = i;
-    send_frame(enc_state.frame);
+    AVFrame* f = enc_state.frame;
+    f->format = enc_state.cc->pix_fmt;
+    f->width = enc_state.cc->width;
+    f->height = enc_state.cc->height;
+
+    const int stride = sizeof(color_t)*f->width;
+    f->data[0] = (uint8_t*)px; f->linesize[0] = stride;
+
+    struct enc_buffer* b = malloc(sizeof(*b));
+    CHECK_IF(b == NULL, "malloc");
+    *b = (struct enc_buffer){ .release = release, .opaque = opaque };
+
+    f->buf[0] = av_buffer_create(
+        f->data[0], stride*f->height, enc_release, b,
+        AV_BUFFER_FLAG_READONLY);
+    if(!f->buf[0]) { failwith("av_buffer_create failed"); }
+
+    f->pts = i;
+    send_frame(f);
+    av_frame_unref(f);
 }
 
 void enc_finalize(void)
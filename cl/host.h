@@ -0,0 +1,96 @@
+/* vim: set ft=c: */
+#pragma once
+
+// the subset of OpenCL C the kernels use, for compiling them as C on the
+// host: vectors are GCC vector extensions, laid out like the cl_float3 of the
+// host's types.h, and the built-ins are defined component-wise
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define __kernel
+#define __constant const
+#define __global
+
+typedef unsigned char uchar;
+typedef unsigned int uint;
+typedef unsigned long ulong;
+
+typedef float float3 __attribute__((vector_size(16)));
+
+// the work-item functions, set by the NDRange emulator
+size_t get_global_id(uint d);
+size_t get_global_size(uint d);
+size_t get_global_offset(uint d);
+
+#define M_PI_F ((float)M_PI)
+
+#define sqrt(x) sqrtf(x)
+#define acos(x) acosf(x)
+#define tan(x) tanf(x)
+#define remquo(x, y, q) remquof(x, y, q)
+
+#define atomic_inc(p) __atomic_fetch_add(p, 1, __ATOMIC_RELAXED)
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+static inline float3 splat(float x)
+{
+    return (float3){ x, x, x };
+}
+
+static inline float dot(float3 a, float3 b)
+{
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+static inline float3 cross(float3 a, float3 b)
+{
+    return (float3){
+        a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0]
+    };
+}
+
+static inline float length3(float3 v)
+{
+    return sqrtf(dot(v, v));
+}
+
+#define length(x) _Generic((x), float3: length3, default: fabsf)(x)
+#define fast_length(x) length(x)
+
+static inline float3 normalize(float3 v)
+{
+    return v / splat(length3(v));
+}
+
+#define fast_normalize(v) normalize(v)
+
+static inline float3 fma3(float3 a, float3 b, float3 c)
+{
+    return (float3){
+        fmaf(a[0], b[0], c[0]), fmaf(a[1], b[1], c[1]), fmaf(a[2], b[2], c[2])
+    };
+}
+
+static inline float3 fma3s(float a, float3 b, float3 c)
+{
+    return fma3(splat(a), b, c);
+}
+
+// a scalar a is widened, as OpenCL does
+#define fma(a, b, c) _Generic((a), float3: fma3, default: fma3s)(a, b, c)
+#define mad(a, b, c) fma(a, b, c)
+
+static inline void vstore3(float3 v, size_t o, float* p)
+{
+    p[3*o] = v[0]; p[3*o + 1] = v[1]; p[3*o + 2] = v[2];
+}
+
+static inline float3 mix(float3 x, float3 y, float a)
+{
+    return x + (y - x)*splat(a);
+}
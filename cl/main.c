@@ -6,9 +6,19 @@
 #include <stdio.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "types.h"
 #include "shared.h"
+#include "native.h"
+#include "bvh.h"
 #include "world.c"
 #include "enc.c"
 #include "rt.c"
@@ -19,40 +29,137 @@ int main(int argc, const char* argv[])
 
     const size_t fps = 24, duration = 15;
 #if defined(DEBUG)
-    const size_t w = 2, h = 2, samples = 1, frames = 1;
+    size_t w = 2, h = 2; const size_t samples = 1, frames = 1;
 #elif defined(QUICK)
-    const size_t w = 1280, h = 720, samples = 1+4*4, frames = fps * duration;
+    size_t w = 1280, h = 720;
+    const size_t samples = 1+4*4, frames = fps * duration;
 #else
-    const size_t w = 1920, h = 1080, samples = 1+8*8, frames = fps * duration;
+    size_t w = 1920, h = 1080;
+    const size_t samples = 1+8*8, frames = fps * duration;
 #endif
 
+    // RT_SIZE=WxH overrides the resolution, e.g. 7680x4320 for an 8K still
+    const char* e = getenv("RT_SIZE");
+    if(e != NULL && sscanf(e, "%zux%zu", &w, &h) != 2) {
+        failwith("invalid RT_SIZE: %s", e);
+    }
+
+    // RT_BUDGET=ms traces each frame with as many of its samples as fit in
+    // the time
+    e = getenv("RT_BUDGET");
+    const double budget = e != NULL ? strtod(e, NULL) : 0;
+
+    // RT_WAVEFRONT=1 traces the paths a bounce at a time, see
+    // rt_draw_wavefront
+    e = getenv("RT_WAVEFRONT");
+    const int wavefront = e != NULL && strcmp(e, "0") != 0;
+
+    // RT_ADAPTIVE=t samples each pixel until the standard error of its mean
+    // is at most t levels, see rt_draw_adaptive
+    e = getenv("RT_ADAPTIVE");
+    const int adaptive = e != NULL;
+    const float threshold = adaptive ? strtof(e, NULL) : 0;
+
     const char* fmt = fn + strlen(fn) - 3;
     if(!fmt || strcmp(fmt, "ppm") == 0) {
         rt_initialize(1);
 
-        color_t buf[w*h];
-        world_t* world = create_world(0, duration, fps);
-        rt_draw(world, w, h, samples, buf);
-        free(world);
-
-        int fd = open(fn, O_CREAT | O_WRONLY,
+        int fd = open(fn, O_CREAT | O_RDWR | O_TRUNC,
                       S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
         CHECK(fd, "open(%s)", fn);
 
+        // the image is traced into the mapped file, its tiles paged out as
+        // they are read back
         rt_write_ppm_header(fd, w, h);
-        rt_write_raw(fd, buf, w, h);
+        const off_t o = lseek(fd, 0, SEEK_CUR); CHECK(o, "lseek");
+        const size_t n = o + sizeof(color_t)*w*h;
+        int r = ftruncate(fd, n); CHECK(r, "ftruncate");
+
+        uint8_t* p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        CHECK_IF(p == MAP_FAILED, "mmap(%s)", fn);
+
+        world_t* world = create_world(0, duration, fps);
+        if(budget > 0) {
+            rt_draw_budget(world, w, h, samples, budget, (color_t*)(p + o));
+        } else if(adaptive) {
+            rt_draw_adaptive(world, w, h, samples, threshold,
+                             (color_t*)(p + o));
+        } else if(wavefront) {
+            rt_draw_wavefront(world, w, h, samples, (color_t*)(p + o));
+        } else {
+            rt_draw(world, w, h, samples, (color_t*)(p + o));
+        }
+        free(world);
 
-        int r = close(fd); CHECK(r, "close");
+        r = munmap(p, n); CHECK(r, "munmap");
+        r = close(fd); CHECK(r, "close");
     } else if(strcmp(fmt, "mkv") == 0) {
+        // RT_BATCH=K traces K frames at a time in one dispatch: only the
+        // camera moves, so the world is written once with the frames' views
+        e = getenv("RT_BATCH");
+        const size_t K = e != NULL ? strtoul(e, NULL, 0) : 0;
+        const int single = budget > 0 || adaptive || wavefront;
+        if(K > 0 && single) {
+            failwith("RT_BATCH can't be combined with RT_BUDGET, RT_ADAPTIVE "
+                     "or RT_WAVEFRONT");
+        }
+
         rt_initialize(fps);
 
-        color_t* buf = enc_initialize(w, h, fps, fn);
-        for(size_t i = 0; i < frames; i++) {
+        // frame i is submitted while the frames before it are traced, read
+        // back and encoded, up to rt_frames_in_flight() at a time
+        // the frames are encoded in place, without copying their pixels
+        enc_initialize(w, h, fps, fn);
+
+        view_t views[K > 0 ? K : 1];
+        for(size_t i = 0; K > 0 && i < frames; i += K) {
+            const size_t k = MIN(K, frames - i);
+            info("rendering frames %zu-%zu/%zu", i, i + k - 1, frames);
+            for(size_t j = 0; j < k; j++) {
+                views[j] = create_view(i + j, duration, fps);
+            }
+
+            world_t* world = create_world(i, duration, fps);
+            void* ref;
+            const color_t* px = rt_draw_batch(world, views, k, w, h, samples,
+                                              &ref);
+            free(world);
+
+            for(size_t j = 0; j < k; j++) {
+                rt_ref(ref); enc(i + j, px + j*w*h, rt_unref, ref);
+            }
+            rt_unref(ref);
+        }
+
+        for(size_t i = 0; K == 0 && single && i < frames; i++) {
             info("rendering frame %zu/%zu", i, frames);
+            color_t* buf = malloc(sizeof(color_t)*w*h);
+            CHECK_IF(buf == NULL, "malloc");
+
             world_t* world = create_world(i, duration, fps);
-            rt_draw(world, w, h, samples, buf);
+            if(budget > 0) {
+                rt_draw_budget(world, w, h, samples, budget, buf);
+            } else if(adaptive) {
+                rt_draw_adaptive(world, w, h, samples, threshold, buf);
+            } else {
+                rt_draw_wavefront(world, w, h, samples, buf);
+            }
             free(world);
-            enc(i);
+
+            enc(i, buf, free, buf);
+        }
+
+        for(size_t i = 0, j = 0; K == 0 && !single && j < frames;) {
+            if(i < frames && rt_in_flight() < rt_frames_in_flight()) {
+                info("rendering frame %zu/%zu", i, frames);
+                world_t* world = create_world(i, duration, fps);
+                rt_submit(world, w, h, samples);
+                free(world);
+                i++;
+            } else {
+                void* ref; const color_t* px = rt_collect_ref(&ref);
+                enc(j++, px, rt_unref, ref);
+            }
         }
         enc_finalize();
     }
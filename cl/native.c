@@ -0,0 +1,278 @@
+#include <r.h>
+
+#include "host.h"
+#include "native.h"
+
+// the kernels are included in the order the OpenCL program is built from
+#include "types.cl"
+#include "entropy.gen.h"
+#include "philox.h"
+#include "rnd.cl"
+#include "shared.h"
+
+// the kernels' inline functions call the shim's static ones, which C99 only
+// allows from static inline functions
+#define inline static inline
+#include "rt.cl"
+#undef inline
+
+// NDRange emulator: the work-items of a range are spread over OpenMP's
+// threads in chunks, with dimension 0 varying the slowest
+static _Thread_local size_t gid[3], gsz[3];
+
+size_t get_global_id(uint d) { return gid[d]; }
+size_t get_global_size(uint d) { return gsz[d]; }
+size_t get_global_offset(uint d) { return 0; }
+
+#define NATIVE_CHUNK 64
+
+typedef void (*item_t)(void* opaque);
+
+static void ndrange(size_t dims, const size_t size[], item_t f, void* opaque)
+{
+    size_t n = 1;
+    for(size_t d = 0; d < dims; d++) n *= size[d];
+
+    #pragma omp parallel for schedule(dynamic, NATIVE_CHUNK)
+    for(size_t i = 0; i < n; i++) {
+        size_t j = i;
+        for(size_t d = dims; d-- > 0;) {
+            gsz[d] = size[d]; gid[d] = j % size[d]; j /= size[d];
+        }
+        for(size_t d = dims; d < 3; d++) { gsz[d] = 1; gid[d] = 0; }
+        f(opaque);
+    }
+}
+
+struct args {
+    const world_t* world;
+    const bvh_skip_node_t* nodes;
+    const object_t* objects;
+    color_t* out;
+    ulong width, height, samples;
+};
+
+static void ray_trace(void* opaque)
+{
+    const struct args* a = opaque;
+    rt_ray_trace(a->world, a->nodes, a->objects, a->out, a->width, a->height, a->samples);
+}
+
+void native_draw(const void* world, const void* nodes, const void* objects,
+                 size_t width, size_t height, size_t samples, void* buf)
+{
+    struct args a = {
+        .world = world, .nodes = nodes, .objects = objects, .out = buf,
+        .width = width, .height = height, .samples = samples,
+    };
+    ndrange(2, (size_t[]){ height, width }, ray_trace, &a);
+}
+
+struct batch_args {
+    const world_t* world;
+    const bvh_skip_node_t* nodes;
+    const object_t* objects;
+    const view_t* views;
+    color_t* out;
+    ulong width, height, samples;
+};
+
+static void ray_trace_batch(void* opaque)
+{
+    const struct batch_args* a = opaque;
+    rt_ray_trace_batch(a->world, a->nodes, a->objects, a->views, a->out,
+                       a->width, a->height, a->samples);
+}
+
+void native_draw_batch(const void* world, const void* nodes,
+                       const void* objects, const void* views, size_t frames,
+                       size_t width, size_t height, size_t samples, void* buf)
+{
+    struct batch_args a = {
+        .world = world, .nodes = nodes, .objects = objects,
+        .views = views, .out = buf,
+        .width = width, .height = height, .samples = samples,
+    };
+    ndrange(3, (size_t[]){ frames, height, width }, ray_trace_batch, &a);
+}
+
+struct acc_args {
+    const world_t* world;
+    const bvh_skip_node_t* nodes;
+    const object_t* objects;
+    uint* sums;
+    ulong width, height, samples, n0, n1, stride;
+};
+
+static void ray_trace_acc(void* opaque)
+{
+    const struct acc_args* a = opaque;
+    rt_ray_trace_acc(a->world, a->nodes, a->objects, a->sums,
+                     a->width, a->height, a->samples, a->n0, a->n1, a->stride);
+}
+
+void native_accumulate(const void* world, const void* nodes,
+                       const void* objects, unsigned int* sums,
+                       size_t width, size_t height, size_t samples,
+                       size_t n0, size_t n1, size_t stride)
+{
+    struct acc_args a = {
+        .world = world, .nodes = nodes, .objects = objects, .sums = sums,
+        .width = width, .height = height, .samples = samples,
+        .n0 = n0, .n1 = n1, .stride = stride,
+    };
+    ndrange(2, (size_t[]){ height, width }, ray_trace_acc, &a);
+}
+
+struct resolve_args {
+    const uint* sums;
+    color_t* out;
+    ulong n;
+};
+
+static void resolve(void* opaque)
+{
+    const struct resolve_args* a = opaque;
+    rt_resolve(a->sums, a->out, a->n);
+}
+
+void native_resolve(const unsigned int* sums, void* buf, size_t pixels,
+                    size_t n)
+{
+    struct resolve_args a = { .sums = sums, .out = buf, .n = n };
+    ndrange(1, (size_t[]){ pixels }, resolve, &a);
+}
+
+struct wf_args {
+    const world_t* world;
+    const bvh_skip_node_t* nodes;
+    const object_t* objects;
+    path_t* paths;
+    uint *queue, *next, count;
+    color_t* out;
+    ulong width, height, samples, p0;
+};
+
+static void wf_generate(void* opaque)
+{
+    const struct wf_args* a = opaque;
+    rt_wf_generate(a->world, a->paths, a->queue,
+                   a->width, a->height, a->samples, a->p0);
+}
+
+static void wf_intersect(void* opaque)
+{
+    const struct wf_args* a = opaque;
+    rt_wf_intersect(a->world, a->nodes, a->objects, a->paths, a->queue);
+}
+
+static void wf_shade(void* opaque)
+{
+    struct wf_args* a = opaque;
+    rt_wf_shade(a->world, a->nodes, a->objects, a->paths,
+                a->queue, a->next, &a->count);
+}
+
+static void wf_accumulate(void* opaque)
+{
+    const struct wf_args* a = opaque;
+    rt_wf_accumulate(a->paths, a->out, a->samples);
+}
+
+size_t native_draw_wavefront(const void* world, const void* nodes,
+                             const void* objects, size_t width, size_t height,
+                             size_t samples, size_t wave, void* buf)
+{
+    struct wf_args a = {
+        .world = world, .nodes = nodes, .objects = objects,
+        .width = width, .height = height, .samples = samples,
+    };
+
+    const size_t n = wave*samples;
+    uint* qs[2] = { malloc(sizeof(uint)*n), malloc(sizeof(uint)*n) };
+    a.paths = malloc(sizeof(path_t)*n);
+    CHECK_IF(a.paths == NULL || qs[0] == NULL || qs[1] == NULL, "malloc");
+
+    size_t rays = 0;
+    for(size_t p0 = 0; p0 < width*height; p0 += wave) {
+        const size_t m = MIN(wave, width*height - p0);
+        a.p0 = p0; a.queue = qs[0];
+        ndrange(1, (size_t[]){ m*samples }, wf_generate, &a);
+
+        for(size_t live = m*samples, q = 0; live > 0; q ^= 1) {
+            rays += live;
+            a.queue = qs[q]; a.next = qs[q ^ 1]; a.count = 0;
+            ndrange(1, (size_t[]){ live }, wf_intersect, &a);
+            ndrange(1, (size_t[]){ live }, wf_shade, &a);
+            live = a.count;
+        }
+
+        a.out = (color_t*)buf + p0;
+        ndrange(1, (size_t[]){ m }, wf_accumulate, &a);
+    }
+
+    free(a.paths); free(qs[0]); free(qs[1]);
+    return rays;
+}
+
+struct adaptive_args {
+    const world_t* world;
+    const bvh_skip_node_t* nodes;
+    const object_t* objects;
+    pixel_stats_t* stats;
+    uint *queue, *next, count;
+    color_t* out;
+    ulong width, height, samples, n0, n1, stride;
+    float threshold;
+};
+
+static void ray_trace_adaptive(void* opaque)
+{
+    struct adaptive_args* a = opaque;
+    rt_ray_trace_adaptive(a->world, a->nodes, a->objects, a->stats,
+                          a->queue, a->next, &a->count,
+                          a->width, a->height, a->samples, 0,
+                          a->n0, a->n1, a->stride, a->threshold);
+}
+
+static void resolve_adaptive(void* opaque)
+{
+    const struct adaptive_args* a = opaque;
+    rt_resolve_adaptive(a->stats, a->out);
+}
+
+size_t native_draw_adaptive(const void* world, const void* nodes,
+                            const void* objects, size_t width, size_t height,
+                            size_t samples, size_t stride, float threshold,
+                            size_t batch, void* buf)
+{
+    const size_t P = width*height;
+    struct adaptive_args a = {
+        .world = world, .nodes = nodes, .objects = objects, .out = buf,
+        .width = width, .height = height, .samples = samples,
+        .stride = stride, .threshold = threshold,
+    };
+
+    uint* qs[2] = { malloc(sizeof(uint)*P), malloc(sizeof(uint)*P) };
+    a.stats = malloc(sizeof(pixel_stats_t)*P);
+    CHECK_IF(a.stats == NULL || qs[0] == NULL || qs[1] == NULL, "malloc");
+
+    size_t traced = 0;
+    for(size_t live = P, q = 0, n0 = 0; live > 0; q ^= 1) {
+        a.queue = qs[q]; a.next = qs[q ^ 1]; a.count = 0;
+        a.n0 = n0; a.n1 = n0 = MIN(n0 + batch, samples);
+        ndrange(1, (size_t[]){ live }, ray_trace_adaptive, &a);
+        traced += live*(a.n1 - a.n0); live = a.count;
+    }
+
+    ndrange(1, (size_t[]){ P }, resolve_adaptive, &a);
+
+    free(a.stats); free(qs[0]); free(qs[1]);
+    return traced;
+}
+
+size_t native_world_size(void) { return sizeof(world_t); }
+size_t native_object_size(void) { return sizeof(object_t); }
+size_t native_node_size(void) { return sizeof(bvh_skip_node_t); }
+size_t native_path_size(void) { return sizeof(path_t); }
+size_t native_stats_size(void) { return sizeof(pixel_stats_t); }
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+
+// rt.cl's kernels compiled as C (see host.h) and run by an NDRange emulator
+// on the host's cores, for when there is no OpenCL device: native_draw is
+// rt_draw with the same world, output and random numbers
+//
+// the kernels' world_t and color_t are their own C types, with the layout of
+// the host's, so they are passed untyped and their sizes are checked: nodes
+// and objects are the hierarchy of the world's spheres (see rt_tree)
+void native_draw(const void* world, const void* nodes, const void* objects,
+                 size_t width, size_t height, size_t samples, void* buf);
+
+// rt_draw_batch's frames, views being the frames' view_t
+void native_draw_batch(const void* world, const void* nodes,
+                       const void* objects, const void* views, size_t frames,
+                       size_t width, size_t height, size_t samples, void* buf);
+
+// rt_draw_budget's batches of samples and their averages
+void native_accumulate(const void* world, const void* nodes,
+                       const void* objects, unsigned int* sums,
+                       size_t width, size_t height, size_t samples,
+                       size_t n0, size_t n1, size_t stride);
+void native_resolve(const unsigned int* sums, void* buf, size_t pixels,
+                    size_t n);
+
+// rt_draw_wavefront's waves of wave pixels, returns the rays traced
+size_t native_draw_wavefront(const void* world, const void* nodes,
+                             const void* objects, size_t width, size_t height,
+                             size_t samples, size_t wave, void* buf);
+
+// rt_draw_adaptive's batches of batch samples, returns the samples traced
+size_t native_draw_adaptive(const void* world, const void* nodes,
+                            const void* objects, size_t width, size_t height,
+                            size_t samples, size_t stride, float threshold,
+                            size_t batch, void* buf);
+
+size_t native_world_size(void);
+size_t native_object_size(void);
+size_t native_node_size(void);
+size_t native_path_size(void);
+size_t native_stats_size(void);
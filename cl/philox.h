@@ -0,0 +1,55 @@
+/* vim: set ft=c: */
+#pragma once
+
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"), shared verbatim by the OpenCL kernels and
+// the CPU tracer: a draw is a pure function of its key and counter so
+// samples can be traced in any order by any number of threads
+
+#ifdef __OPENCL_VERSION__
+typedef uint philox_u32;
+typedef ulong philox_u64;
+#define PHILOX_INLINE inline
+#else
+#include <stdint.h>
+typedef uint32_t philox_u32;
+typedef uint64_t philox_u64;
+#define PHILOX_INLINE static inline
+#endif
+
+typedef struct { philox_u32 v[4]; } philox4_t;
+typedef struct { philox_u32 v[2]; } philox2_t;
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+PHILOX_INLINE philox4_t philox4x32(philox4_t c, philox2_t k)
+{
+    for(int i = 0; i < 10; i++) {
+        const philox_u64 p0 = (philox_u64)PHILOX_M0 * c.v[0];
+        const philox_u64 p1 = (philox_u64)PHILOX_M1 * c.v[2];
+        c = (philox4_t){ {
+            (philox_u32)(p1 >> 32) ^ c.v[1] ^ k.v[0], (philox_u32)p1,
+            (philox_u32)(p0 >> 32) ^ c.v[3] ^ k.v[1], (philox_u32)p0,
+        } };
+        k.v[0] += PHILOX_W0; k.v[1] += PHILOX_W1;
+    }
+    return c;
+}
+
+// the draws of the given sample of a pixel at a bounce of a frame
+PHILOX_INLINE philox4_t philox_draw(philox_u32 seed, philox_u32 frame,
+                                    philox_u32 pixel, philox_u32 sample,
+                                    philox_u32 bounce)
+{
+    return philox4x32((philox4_t){ { pixel, sample, bounce, 0 } },
+                      (philox2_t){ { seed, frame } });
+}
+
+// uniform in [0, 1) with the word's top 24 bits
+PHILOX_INLINE float philox_uniform(philox_u32 x)
+{
+    return (x >> 8) * (1.0f / 16777216);
+}
@@ -1,17 +1,15 @@
 /* vim: set ft=c: */
 
-seed_t rnd(seed_t* seed)
+// the draws of a sample are philox4x32 words, see philox.h
+
+// 64 bits of a draw, e.g. to test against a probability_t
+ulong rnd_bits(philox4_t r)
 {
-    // xorshift64
-    seed_t x = *seed;
-    x ^= x << 13;
-    x ^= x >> 7;
-    x ^= x << 17;
-    *seed = x;
-    return x;
+    return (ulong)r.v[0] << 32 | r.v[1];
 }
 
-float uniform_float(ulong x)
+// uniform in [0, 1) from the bits of a word above the ones unit_vectors uses
+float uniform_float(uint x)
 {
-    return (float)x/ULONG_MAX;
+    return (x >> 9) * (1.0f / (1 << 23));
 }
@@ -1,13 +1,173 @@
-static struct {
+#define RT_FRAMES_IN_FLIGHT_MAX 8
+#define RT_PLATFORMS_MAX 4
+#define RT_DEVICES_MAX 8
+
+// a platform's devices share a context and a program: a program built from
+// source is built by a thread while the caller goes on, its binaries are then
+// cached, see rt_program
+struct rt_platform {
     cl_context ctx;
-    cl_command_queue q;
     cl_program p;
 
+    // p specialized to the scene, see rt_specialize
+    cl_program spec;
+
+    pthread_t thread; int pending;
+    cl_uint ds; cl_device_id ids[RT_DEVICES_MAX]; uint64_t keys[RT_DEVICES_MAX];
+    const char* flags;
+    struct stopwatch* stopwatch_build;
+};
+
+// how the kernel is enqueued on a device: rt_ray_trace or, transposed,
+// rt_ray_trace_t and the local size, the driver's when it is 0
+struct rt_tune {
+    cl_uint transposed;
+    size_t local[2];
+};
+
+// a frame is split into bands of rows, one for each device, sized by the
+// throughput measured for the device in the previous frames
+struct rt_device {
+    struct rt_platform* pl;
+    cl_device_id id; uint64_t key;
+    char name[100];
+
+    // the kernel runs on q, the worlds are written on q_write and the bands
+    // read back on q_read: so that a frame is traced while the previous one
+    // is read back
+    cl_command_queue q, q_write, q_read;
+    cl_kernel rt[2];
+
+    // tuned for the frame's shape, see rt_tune: untuned when RT_TUNE asks
+    // for the shape to be benchmarked with the frame's first band
+    struct rt_tune tune; int untuned;
+
+    // a band is traced in tiles of at most tile pixels, sized to the
+    // device's memory, into two output buffers: a tile is traced while the
+    // one before it is read back, read being the last read of each buffer
+    size_t tile, tiles;
+    cl_mem out[2]; cl_event read[2];
+
+    // the device shares the host's memory: a band that fits a tile is traced
+    // straight into the frame's pixels and mapped instead of read back
+    cl_bool unified;
+
+    // rows per ms, an exponential average of the bands' kernel times
+    double rate; int measured;
+
+    // rt_draw_batch's kernel and buffers, grown to the largest batch
+    cl_kernel batch;
+    cl_mem batch_in, batch_views, batch_out;
+    size_t batch_in_size, batch_views_size, batch_out_size;
+
+    // rt_draw_budget's kernels and the running sums of the band's tiles,
+    // sums_size bytes each, its world and a tile's averages go through
+    // batch_in and batch_out
+    cl_kernel acc, resolve;
+    cl_mem* sums; size_t sums_len, sums_size;
+
+    // the hierarchy written last, see rt_tree_write
+    cl_mem nodes, objects; size_t nodes_size, objects_size;
+    uint64_t tree;
+
+    // rt_draw_wavefront's kernels, its paths, their two queues and the
+    // count of the next one, the world and the averages go through batch_in
+    // and batch_out
+    cl_kernel generate, intersect, shade, accumulate;
+    cl_mem paths, queues[2], count;
+    size_t paths_size, queues_size[2], count_size;
+
+    // rt_draw_adaptive's kernels and its band's pixels' samples, the
+    // pixels still sampled go through queues
+    cl_kernel adaptive, resolve_adaptive;
+    cl_mem stats; size_t stats_size;
+};
+
+struct rt_band {
+    size_t y0, rows;
+    cl_mem in; size_t in_size;
+
+    // the first and last of the band's tiles' kernels and the last read
+    cl_event first, last, read;
+
+    // the band's pixels mapped for a unified device until collected
+    void* mapped;
+};
+
+// a frame's pixels, shared by a slot and those rt_collect_ref hands them to:
+// once unreferenced they go back to the pool (see rt_pixels_get)
+struct rt_pixels {
+    atomic_int refs;
+    color_t* p; size_t n;
+    struct rt_pixels* next;
+
+    // the pixels wrapped for each unified device, its band at offset o of n
+    // bytes: created on first use, rewrapped when the band moves and
+    // released with the pixels; the device's next write waits for the unmap
+    struct rt_mapping {
+        cl_mem mem; size_t o, n;
+        cl_event unmap;
+    } host[RT_DEVICES_MAX];
+};
+
+static struct {
+    struct rt_platform platforms[RT_PLATFORMS_MAX]; size_t platforms_len;
+    struct rt_device devices[RT_DEVICES_MAX]; size_t devices_len;
+
+    // the kernels run on the host, see native.h
+    int native;
+
+    // RT_SPECIALIZE: the programs are specialized to the hashed scene
+    int specialize; uint64_t scene;
+
+    // the world's spheres in a bounding volume hierarchy and the world
+    // without them, rebuilt when the hashed spheres change (see rt_tree):
+    // RT_BVH=0 leaves them in the world
+    struct rt_tree {
+        int disabled; uint64_t hash;
+        world_t* world; size_t world_size;
+        bvh_skip_node_t* nodes; size_t nodes_len;
+        object_t* objects; size_t objects_len;
+    } tree;
+
+    // the buffers of the last frame's size, reused by the frames that
+    // follow: only the world is written for each frame
+    struct rt_frame {
+        size_t width, height, samples;
+
+        // the bands' rows are multiples of align, so that the bands of a
+        // unified device start at page boundaries
+        size_t align;
+
+        // frame i is in slot i % depth from rt_submit until rt_collect
+        size_t depth, submitted, collected;
+        struct rt_slot {
+            world_t* world; size_t world_size;
+
+            // the frame is read back to dst: the slot's pixels, or rt_draw's
+            // caller's buffer
+            struct rt_pixels* px; color_t* dst;
+            struct rt_band bands[RT_DEVICES_MAX];
+        } slots[RT_FRAMES_IN_FLIGHT_MAX];
+    } frame;
+
+    // the unreferenced pixels, released to it by rt_unref from the encoder's
+    // threads
+    struct {
+        pthread_mutex_t lock;
+        struct rt_pixels* free;
+    } pool;
+
     struct stopwatch* stopwatch_init;
     struct stopwatch* stopwatch_draw;
+    struct stopwatch* stopwatch_setup;
+    struct stopwatch* stopwatch_collect;
     struct stopwatch* stopwatch_write;
+    struct stopwatch* stopwatch_specialize;
+    struct stopwatch* stopwatch_tree;
 } rt_state;
 
+
 void rt_write_raw(int fd, const color_t buf[], size_t width, size_t height)
 {
     stopwatch_start(rt_state.stopwatch_write);
@@ -65,61 +225,335 @@ static void rt_build_callback(cl_program p, void* data)
     }
 }
 
-void rt_initialize(size_t fps)
+// the files the program is built from, in order
+static const char* rt_sources[] = {
+    "types.cl", "entropy.gen.h", "philox.h", "rnd.cl", "shared.h", "rt.cl",
+};
+
+// FNV-1a
+static uint64_t rt_hash(uint64_t h, const void* p, size_t n)
 {
-    rt_state.stopwatch_init = stopwatch_mk("rt_initialize", 1);
-    rt_state.stopwatch_draw = stopwatch_mk("rt_draw", fps);
-    rt_state.stopwatch_write = stopwatch_mk("rt_write", fps);
+    for(size_t i = 0; i < n; i++) {
+        h = (h ^ ((const uint8_t*)p)[i]) * 0x100000001b3;
+    }
+    return h;
+}
 
-    stopwatch_start(rt_state.stopwatch_init);
+static uint64_t rt_hash_file(uint64_t h, const char* fn)
+{
+    int fd = open(fn, O_RDONLY); CHECK(fd, "open(%s)", fn);
 
-    xorshift_state_initalize();
+    char buf[4096]; ssize_t r;
+    while((r = read(fd, buf, sizeof(buf))) > 0) h = rt_hash(h, buf, r);
+    CHECK(r, "read(%s)", fn);
+
+    r = close(fd); CHECK(r, "close");
+    return h;
+}
+
+// the cache's directory or NULL when RT_CACHE is empty
+static const char* rt_cache_dir(void)
+{
+    const char* e = getenv("RT_CACHE");
+    if(e == NULL) e = ".cache";
+    if(*e == 0) return NULL;
+
+    if(mkdir(e, 0755) < 0 && errno != EEXIST) {
+        info("unable to create the program cache: %s", e);
+        return NULL;
+    }
+    return e;
+}
+
+// a device's binary is keyed by the sources, the build flags and the
+// device and its driver
+static uint64_t rt_cache_key(uint64_t h, cl_device_id id)
+{
+    const cl_device_info is[] = {
+        CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION
+    };
+    for(size_t i = 0; i < LENGTH(is); i++) {
+        char buf[256]; size_t n;
+        cl_int r = clGetDeviceInfo(id, is[i], sizeof(buf), buf, &n);
+        CHECK_OCL(r, "clGetDeviceInfo");
+        h = rt_hash(h, buf, n);
+    }
+    return h;
+}
+
+static unsigned char* rt_cache_load(const char* dir, uint64_t key,
+                                    const char* ext, size_t* n)
+{
+    char fn[PATH_MAX];
+    snprintf(fn, sizeof(fn), "%s/%016"PRIx64".%s", dir, key, ext);
+
+    int fd = open(fn, O_RDONLY);
+    if(fd < 0) return NULL;
 
-    const char* src[] = { R"(
-#include "types.cl"
-)", R"(
-#include "entropy.gen.h"
-)", R"(
-#include "rnd.cl"
-)", R"(
-#include "shared.h"
-)", R"(
-#include "rt.cl"
-)", };
+    struct stat st; int r = fstat(fd, &st); CHECK(r, "fstat(%s)", fn);
+    unsigned char* buf = malloc(MAX(st.st_size, 1));
+    CHECK_IF(buf == NULL, "malloc");
 
-    size_t src_len[LENGTH(src)];
-    for(size_t i = 0; i < LENGTH(src_len); i++) {
-        src_len[i] = strlen(src[i]);
+    *n = 0;
+    while(*n < st.st_size) {
+        ssize_t m = read(fd, buf + *n, st.st_size - *n);
+        CHECK(m, "read(%s)", fn);
+        if(m == 0) break;
+        *n += m;
     }
 
-    cl_uint ds;
-    cl_int r = clGetDeviceIDs(NULL, CL_DEVICE_TYPE_GPU, 0, NULL, &ds);
-    CHECK_OCL(r, "clGetDeviceIDs");
+    r = close(fd); CHECK(r, "close");
+    return buf;
+}
 
-    cl_device_id ids[ds];
-    r = clGetDeviceIDs(NULL, CL_DEVICE_TYPE_GPU, ds, ids, NULL);
-    CHECK_OCL(r, "clGetDeviceIDs");
+static void rt_cache_store(const char* dir, uint64_t key, const char* ext,
+                           const unsigned char* buf, size_t n)
+{
+    char fn[PATH_MAX], tmp[PATH_MAX];
+    snprintf(fn, sizeof(fn), "%s/%016"PRIx64".%s", dir, key, ext);
+    snprintf(tmp, sizeof(tmp), "%s/%016"PRIx64".%d", dir, key, getpid());
 
-    cl_device_id def;
-    r = clGetDeviceIDs(NULL, CL_DEVICE_TYPE_DEFAULT, 1, &def, NULL);
-    CHECK_OCL(r, "clGetDeviceIDs");
+    int fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+    if(fd < 0) { info("unable to write %s", tmp); return; }
 
-    char def_name[100];
-    r = clGetDeviceInfo(def, CL_DEVICE_NAME, sizeof(def_name), def_name, NULL);
-    CHECK_OCL(r, "clGetDeviceInfo");
+    // the cache is only an optimization: a full or read-only disk leaves
+    // the binary uncached
+    for(size_t i = 0; i < n;) {
+        ssize_t r = write(fd, buf + i, n - i);
+        if(r < 0) {
+            info("unable to write %s", tmp);
+            close(fd); unlink(tmp); return;
+        }
+        i += r;
+    }
 
-    info("found %u device with default: %s", ds, def_name);
+    if(close(fd) != 0) { info("unable to write %s", tmp); unlink(tmp); return; }
 
-    rt_state.ctx = clCreateContext(NULL, ds, ids, rt_error_callback, NULL, &r);
-    CHECK_OCL(r, "clCreateContext");
+    // renamed so that a concurrent launch never loads a partial binary
+    if(rename(tmp, fn) != 0) {
+        info("unable to rename %s to %s", tmp, fn);
+        unlink(tmp); return;
+    }
+    debug("cached: %s (%zu bytes)", fn, n);
+}
+
+
+// the cached binaries of all the platform's devices, keyed by keys, or NULL
+static cl_program rt_program_from_cache(const struct rt_platform* pl,
+                                        const uint64_t keys[])
+{
+    const char* dir = rt_cache_dir();
+    if(dir == NULL) return NULL;
+
+    size_t ns[pl->ds]; unsigned char* bins[pl->ds]; cl_uint n = 0;
+    for(; n < pl->ds; n++) {
+        bins[n] = rt_cache_load(dir, keys[n], "bin", &ns[n]);
+        if(bins[n] == NULL) break;
+    }
+
+    cl_program p = NULL;
+    if(n == pl->ds) {
+        cl_int r, st[pl->ds];
+        p = clCreateProgramWithBinary(pl->ctx, pl->ds, pl->ids, ns,
+                                      (const unsigned char**)bins, st, &r);
+        if(r == CL_SUCCESS) {
+            r = clBuildProgram(p, pl->ds, pl->ids, pl->flags, NULL, NULL);
+        }
+
+        if(r != CL_SUCCESS) {
+            info("discarding the cached program binaries: %d", r);
+            if(p != NULL) clReleaseProgram(p);
+            p = NULL;
+        }
+    }
+
+    while(n-- > 0) free(bins[n]);
+    return p;
+}
+
+static void rt_program_store(const struct rt_platform* pl, cl_program p,
+                             const uint64_t keys[])
+{
+    const char* dir = rt_cache_dir();
+    if(dir == NULL) return;
+
+    size_t ns[pl->ds];
+    cl_int r = clGetProgramInfo(p, CL_PROGRAM_BINARY_SIZES,
+                                sizeof(ns), ns, NULL);
+    CHECK_OCL(r, "clGetProgramInfo");
+
+    unsigned char* bins[pl->ds];
+    for(size_t i = 0; i < pl->ds; i++) {
+        bins[i] = malloc(MAX(ns[i], 1));
+        CHECK_IF(bins[i] == NULL, "malloc");
+    }
+
+    r = clGetProgramInfo(p, CL_PROGRAM_BINARIES, sizeof(bins), bins, NULL);
+    CHECK_OCL(r, "clGetProgramInfo");
+
+    for(size_t i = 0; i < pl->ds; i++) {
+        if(ns[i] > 0) rt_cache_store(dir, keys[i], "bin", bins[i], ns[i]);
+        free(bins[i]);
+    }
+}
 
-    rt_state.q = clCreateCommandQueueWithProperties(
-        rt_state.ctx, def, NULL, &r);
-    CHECK_OCL(r, "clCreateCommandQueueWithProperties");
+// the program from rt_sources, with spec's definitions before rt.cl when it
+// is not NULL
+static cl_program rt_program_from_source(const struct rt_platform* pl,
+                                         const char* spec)
+{
+    char inc[LENGTH(rt_sources)][64];
+    const char* src[LENGTH(rt_sources) + 1];
+    size_t src_len[LENGTH(src)], n = 0;
+    for(size_t i = 0; i < LENGTH(rt_sources); i++) {
+        if(spec != NULL && strcmp(rt_sources[i], "rt.cl") == 0) {
+            src[n] = spec; src_len[n++] = strlen(spec);
+        }
+
+        src[n] = inc[i];
+        src_len[n++] = snprintf(inc[i], sizeof(inc[i]),
+                                "\n#include \"%s\"\n", rt_sources[i]);
+    }
 
-    rt_state.p = clCreateProgramWithSource(
-        rt_state.ctx, LENGTH(src), src, src_len, &r);
+    cl_int r;
+    cl_program p = clCreateProgramWithSource(pl->ctx, n, src, src_len, &r);
     CHECK_OCL(r, "clCreateProgramWithSource");
+    return p;
+}
+
+static void* rt_build(void* opaque)
+{
+    struct rt_platform* pl = opaque;
+    stopwatch_start(pl->stopwatch_build);
+
+    cl_int r = clBuildProgram(pl->p, pl->ds, pl->ids, pl->flags, NULL, NULL);
+    rt_build_callback(pl->p, NULL);
+    CHECK_OCL(r, "clBuildProgram");
+    rt_program_store(pl, pl->p, pl->keys);
+
+    stopwatch_stop(pl->stopwatch_build);
+    return NULL;
+}
+
+// the platform's built program, waiting for its build if it is still running
+static cl_program rt_program(struct rt_platform* pl)
+{
+    if(pl->pending) {
+        int r = pthread_join(pl->thread, NULL);
+        CHECK_IF(r != 0, "pthread_join");
+        pl->pending = 0;
+    }
+    return pl->p;
+}
+
+static void rt_platform_mk(cl_platform_id id, cl_device_type type,
+                           uint64_t h, const char* flags)
+{
+    struct rt_platform* pl = &rt_state.platforms[rt_state.platforms_len];
+
+    // RT_TILE bounds the pixels of a tile further
+    const char* e = getenv("RT_TILE");
+
+    cl_int r = clGetDeviceIDs(id, type, RT_DEVICES_MAX, pl->ids, &pl->ds);
+    if(r != CL_SUCCESS || pl->ds == 0) return;
+    pl->ds = MIN(pl->ds, RT_DEVICES_MAX - rt_state.devices_len);
+    if(pl->ds == 0) return;
+    rt_state.platforms_len += 1;
+
+    pl->ctx = clCreateContext(NULL, pl->ds, pl->ids, rt_error_callback, NULL,
+                              &r);
+    CHECK_OCL(r, "clCreateContext");
+
+    const cl_queue_properties profiling[] = {
+        CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0
+    };
+
+    for(size_t i = 0; i < pl->ds; i++) {
+        pl->keys[i] = rt_cache_key(h, pl->ids[i]);
+
+        struct rt_device* d = &rt_state.devices[rt_state.devices_len++];
+        d->pl = pl; d->id = pl->ids[i]; d->key = pl->keys[i]; d->rate = 1;
+
+        r = clGetDeviceInfo(d->id, CL_DEVICE_NAME, sizeof(d->name), d->name,
+                            NULL);
+        CHECK_OCL(r, "clGetDeviceInfo");
+        info("device %zu: %s", rt_state.devices_len - 1, d->name);
+
+        cl_ulong alloc, global;
+        r = clGetDeviceInfo(d->id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(alloc),
+                            &alloc, NULL);
+        CHECK_OCL(r, "clGetDeviceInfo");
+        r = clGetDeviceInfo(d->id, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global),
+                            &global, NULL);
+        CHECK_OCL(r, "clGetDeviceInfo");
+
+        r = clGetDeviceInfo(d->id, CL_DEVICE_HOST_UNIFIED_MEMORY,
+                            sizeof(d->unified), &d->unified, NULL);
+        CHECK_OCL(r, "clGetDeviceInfo");
+        if(d->unified) {
+            info("device %zu: shares the host's memory",
+                 rt_state.devices_len - 1);
+        }
+
+        // the two tile buffers get at most a quarter of the device's memory
+        d->tile = MIN(alloc, global/8)/sizeof(color_t);
+        if(e != NULL) d->tile = MIN(d->tile, strtoul(e, NULL, 0));
+        d->tile = MAX(d->tile, 1);
+        info("device %zu: tiles of up to %zu pixels",
+             rt_state.devices_len - 1, d->tile);
+
+        d->q = clCreateCommandQueueWithProperties(pl->ctx, d->id, profiling,
+                                                  &r);
+        CHECK_OCL(r, "clCreateCommandQueueWithProperties");
+
+        cl_command_queue* qs[] = { &d->q_write, &d->q_read };
+        for(size_t j = 0; j < LENGTH(qs); j++) {
+            *qs[j] = clCreateCommandQueueWithProperties(
+                pl->ctx, d->id, NULL, &r);
+            CHECK_OCL(r, "clCreateCommandQueueWithProperties");
+        }
+    }
+
+    pl->flags = flags;
+    pl->stopwatch_build = stopwatch_mk("rt_build", 1);
+    if((pl->p = rt_program_from_cache(pl, pl->keys)) != NULL) {
+        info("loaded the program from the cache");
+        return;
+    }
+
+    pl->p = rt_program_from_source(pl, NULL);
+
+    // the build overlaps whatever the caller does before its first frame
+    r = pthread_create(&pl->thread, NULL, rt_build, pl);
+    CHECK_IF(r != 0, "pthread_create");
+    pl->pending = 1;
+}
+
+// returns 0 when there is no device to run the kernels on
+static int rt_initialize_ocl(void)
+{
+    // RT_DEVICES is gpu, cpu or all: a platform's devices of the type are
+    // used, a CPU runtime (such as pocl) is a platform of its own
+    const char* e = getenv("RT_DEVICES");
+    cl_device_type type = CL_DEVICE_TYPE_ALL;
+    if(e == NULL || strcmp(e, "all") == 0) {
+    } else if(strcmp(e, "gpu") == 0) {
+        type = CL_DEVICE_TYPE_GPU;
+    } else if(strcmp(e, "cpu") == 0) {
+        type = CL_DEVICE_TYPE_CPU;
+    } else {
+        failwith("unknown RT_DEVICES: %s", e);
+    }
+
+    cl_uint ps;
+    cl_int r = clGetPlatformIDs(0, NULL, &ps);
+    if(r != CL_SUCCESS || ps == 0) {
+        debug("clGetPlatformIDs == %d", r);
+        return 0;
+    }
+
+    cl_platform_id ids[ps];
+    r = clGetPlatformIDs(ps, ids, NULL); CHECK_OCL(r, "clGetPlatformIDs");
 
 #ifndef DEBUG
     const char* flags = "-cl-std=CL2.0";
@@ -127,96 +561,1771 @@ void rt_initialize(size_t fps)
     const char* flags = "-cl-std=CL2.0 -DDEBUG";
 #endif
 
-    r = clBuildProgram(rt_state.p, ds, ids, flags, rt_build_callback, NULL);
-    CHECK_OCL(r, "clBuildProgram");
+    uint64_t h = rt_hash(0xcbf29ce484222325, flags, strlen(flags) + 1);
+    for(size_t i = 0; i < LENGTH(rt_sources); i++) {
+        h = rt_hash_file(h, rt_sources[i]);
+    }
+
+    for(size_t i = 0; i < MIN(ps, RT_PLATFORMS_MAX); i++) {
+        rt_platform_mk(ids[i], type, h, flags);
+    }
+
+    return rt_state.devices_len > 0;
+}
+
+void rt_initialize(size_t fps)
+{
+    rt_state.stopwatch_init = stopwatch_mk("rt_initialize", 1);
+    rt_state.stopwatch_draw = stopwatch_mk("rt_draw", fps);
+    rt_state.stopwatch_setup = stopwatch_mk("rt_draw_setup", fps);
+    rt_state.stopwatch_collect = stopwatch_mk("rt_collect", fps);
+    rt_state.stopwatch_write = stopwatch_mk("rt_write", fps);
+    rt_state.stopwatch_specialize = stopwatch_mk("rt_specialize", 1);
+    rt_state.stopwatch_tree = stopwatch_mk("rt_tree", 1);
+
+    stopwatch_start(rt_state.stopwatch_init);
+
+    int r = pthread_mutex_init(&rt_state.pool.lock, NULL);
+    CHECK_IF(r != 0, "pthread_mutex_init");
+
+    xorshift_state_initalize();
+
+    if(native_world_size() != sizeof(world_t)
+       || native_object_size() != sizeof(object_t)
+       || native_node_size() != sizeof(bvh_skip_node_t)
+       || native_path_size() != sizeof(path_t)
+       || native_stats_size() != sizeof(pixel_stats_t)) {
+        failwith("the native kernels' world layout differs from the host's");
+    }
+
+    // RT_BACKEND is native or opencl, by default the kernels run natively
+    // only when there is no OpenCL device
+    const char* e = getenv("RT_BACKEND");
+    if(e != NULL && strcmp(e, "native") == 0) {
+        rt_state.native = 1;
+    } else if(e != NULL && strcmp(e, "opencl") != 0) {
+        failwith("unknown RT_BACKEND: %s", e);
+    } else if(!rt_initialize_ocl()) {
+        if(e != NULL) { failwith("no OpenCL device found"); }
+        info("no OpenCL device found, falling back to the native backend");
+        rt_state.native = 1;
+    }
+    info("backend: %s", rt_state.native ? "native" : "opencl");
+
+    // RT_SPECIALIZE=1 builds the kernels for the scene drawn, the native
+    // kernels are compiled ahead of it
+    e = getenv("RT_SPECIALIZE");
+    rt_state.specialize = !rt_state.native && e != NULL && *e != 0;
+
+    e = getenv("RT_BVH");
+    rt_state.tree.disabled = e != NULL && strcmp(e, "0") == 0;
+
+    // RT_FRAMES_IN_FLIGHT bounds the frames submitted but not yet collected,
+    // the native backend draws each frame as it is submitted
+    e = getenv("RT_FRAMES_IN_FLIGHT");
+    rt_state.frame.depth = e != NULL ? strtoul(e, NULL, 0) : 3;
+    if(rt_state.native) rt_state.frame.depth = 1;
+    if(rt_state.frame.depth < 1
+       || rt_state.frame.depth > RT_FRAMES_IN_FLIGHT_MAX) {
+        failwith("RT_FRAMES_IN_FLIGHT not in 1..%d", RT_FRAMES_IN_FLIGHT_MAX);
+    }
 
     stopwatch_stop(rt_state.stopwatch_init);
 }
 
-void rt_deinitialize(void)
+static void rt_release(cl_mem* m)
 {
-    cl_int r = clReleaseProgram(rt_state.p); CHECK_OCL(r, "clReleaseProgram");
-    r = clReleaseCommandQueue(rt_state.q); CHECK_OCL(r, "clReleaseCommandQueue");
-    r = clReleaseContext(rt_state.ctx); CHECK_OCL(r, "clReleaseContext");
+    if(*m == NULL) return;
+    cl_int r = clReleaseMemObject(*m); CHECK_OCL(r, "clReleaseMemObject");
+    *m = NULL;
 }
 
-void rt_run(void)
+static void rt_release_event(cl_event* e)
 {
-    cl_int r = clFinish(rt_state.q); CHECK_OCL(r, "clFinish");
+    if(*e == NULL) return;
+    cl_int r = clReleaseEvent(*e); CHECK_OCL(r, "clReleaseEvent");
+    *e = NULL;
 }
 
-void rt_draw(const world_t* w, size_t width, size_t height, size_t samples,
-             color_t buf[])
+static cl_mem rt_buffer(struct rt_device* d, cl_mem_flags flags, size_t size)
 {
-    stopwatch_start(rt_state.stopwatch_draw);
-    cl_int r;
+    cl_int r; cl_mem m = clCreateBuffer(d->pl->ctx, flags, size, NULL, &r);
+    CHECK_OCL(r, "clCreateBuffer(%zu)", size);
+    return m;
+}
 
-    // buffers
-    cl_mem in = clCreateBuffer(rt_state.ctx,
-        CL_MEM_READ_ONLY | CL_MEM_HOST_NO_ACCESS | CL_MEM_COPY_HOST_PTR,
-        world_size(w), (void*)w, &r);
-    CHECK_OCL(r, "in = clCreateBuffer");
+// grows the buffer of *size bytes to hold n bytes
+static void rt_buffer_fit(struct rt_device* d, cl_mem* m, size_t* size,
+                          cl_mem_flags flags, size_t n)
+{
+    if(*m != NULL && *size >= n) return;
+    rt_release(m); *size = n; *m = rt_buffer(d, flags, n);
+}
 
-    const size_t N = sizeof(color_t)*width*height;
+// grows the *len buffers of *size bytes to n buffers of at least m bytes
+static void rt_buffers_fit(struct rt_device* d, cl_mem** ms, size_t* len,
+                           size_t* size, cl_mem_flags flags, size_t n,
+                           size_t m)
+{
+    if(*size < m) {
+        for(size_t i = 0; i < *len; i++) rt_release(&(*ms)[i]);
+        *size = m;
+    }
 
-    cl_mem data = clCreateBuffer(rt_state.ctx,
-        CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
-        N * samples, NULL, &r);
-    CHECK_OCL(r, "out = clCreateBuffer");
+    if(n > *len) {
+        *ms = realloc(*ms, sizeof(cl_mem)*n); CHECK_IF(*ms == NULL, "realloc");
+        for(size_t i = *len; i < n; i++) (*ms)[i] = NULL;
+        *len = n;
+    }
 
-    cl_mem out = clCreateBuffer(rt_state.ctx,
-        CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
-        N, NULL, &r);
-    CHECK_OCL(r, "out = clCreateBuffer");
+    for(size_t i = 0; i < n; i++) {
+        if((*ms)[i] == NULL) (*ms)[i] = rt_buffer(d, flags, *size);
+    }
+}
 
+static void rt_kernel_arg(cl_kernel k, cl_uint i, size_t size, const void* v)
+{
+    cl_int r = clSetKernelArg(k, i, size, v); CHECK_OCL(r, "clSetKernelArg");
+}
 
-    // kernels
-    cl_kernel rt = clCreateKernel(rt_state.p, "rt_ray_trace", &r);
-    CHECK_OCL(r, "clCreateKernel");
+static void rt_device_arg(struct rt_device* d, cl_uint i, size_t size,
+                          const void* v)
+{
+    for(size_t j = 0; j < LENGTH(d->rt); j++) {
+        rt_kernel_arg(d->rt[j], i, size, v);
+    }
+}
 
-    r = clSetKernelArg(rt, 0, sizeof(in), &in);
-    CHECK_OCL(r, "clSetKernelArg");
+// the range of rows and cols pixels at y, x, transposed for rt_ray_trace_t
+static cl_int rt_enqueue(struct rt_device* d, const struct rt_tune* t,
+                         size_t y, size_t x, size_t rows, size_t cols,
+                         cl_uint n, const cl_event* ws, cl_event* e)
+{
+    size_t o[2] = { y, x }, g[2] = { rows, cols };
+    if(t->transposed) {
+        o[0] = x; o[1] = y; g[0] = cols; g[1] = rows;
+    }
+    return clEnqueueNDRangeKernel(d->q, d->rt[t->transposed], 2, o, g,
+                                  t->local[0] == 0 ? NULL : t->local,
+                                  n, ws, e);
+}
 
-    r = clSetKernelArg(rt, 1, sizeof(data), &data);
-    CHECK_OCL(r, "clSetKernelArg");
+// a tuning is keyed by the device's program and the frame's shape
+static uint64_t rt_tune_key(const struct rt_device* d)
+{
+    const struct rt_frame* f = &rt_state.frame;
+    const cl_ulong shape[] = { f->width, f->height, f->samples };
+    return rt_hash(d->key, shape, sizeof(shape));
+}
 
+// the device's cached tuning for the frame's shape, otherwise the driver's
+// defaults: benchmarked with the next band when RT_TUNE is set
+static void rt_tune_load(struct rt_device* d)
+{
+    d->tune = (struct rt_tune){ 0 };
 
-    cl_kernel sampler = clCreateKernel(rt_state.p, "rt_sample", &r);
-    CHECK_OCL(r, "clCreateKernel");
+    const char* dir = rt_cache_dir();
+    if(dir != NULL) {
+        size_t n;
+        unsigned char* buf = rt_cache_load(dir, rt_tune_key(d), "tune", &n);
+        const int hit = buf != NULL && n == sizeof(d->tune);
+        if(hit) memcpy(&d->tune, buf, n);
+        free(buf);
 
-    r = clSetKernelArg(sampler, 0, sizeof(data), &data);
-    CHECK_OCL(r, "clSetKernelArg");
+        if(hit) {
+            debug("device %zu: cached local size %zux%zu%s",
+                  d - rt_state.devices, d->tune.local[0], d->tune.local[1],
+                  d->tune.transposed ? " (transposed)" : "");
+            d->untuned = 0;
+            return;
+        }
+    }
 
-    r = clSetKernelArg(sampler, 1, sizeof(samples), &samples);
-    CHECK_OCL(r, "clSetKernelArg");
+    const char* e = getenv("RT_TUNE");
+    d->untuned = e != NULL && *e != 0;
+}
 
-    r = clSetKernelArg(sampler, 2, sizeof(out), &out);
-    CHECK_OCL(r, "clSetKernelArg");
+// the kernel's ms on the tile of rows and cols pixels at y, or -1 when the
+// device rejects the local size
+static double rt_tune_run(struct rt_device* d, const struct rt_tune* t,
+                          size_t y, size_t rows, size_t cols)
+{
+    cl_event e;
+    cl_int r = rt_enqueue(d, t, y, 0, rows, cols, 0, NULL, &e);
+    if(r != CL_SUCCESS) return -1;
+    r = clWaitForEvents(1, &e); CHECK_OCL(r, "clWaitForEvents");
 
-    // enqueue
-    cl_event e0;
-    r = clEnqueueNDRangeKernel(
-        rt_state.q, rt, 3, NULL, (size_t[]){ height, width, samples }, NULL,
-        0, NULL, &e0);
-    CHECK_OCL(r, "clEnqueueNDRangeKernel");
+    cl_ulong t0, t1;
+    r = clGetEventProfilingInfo(
+        e, CL_PROFILING_COMMAND_START, sizeof(t0), &t0, NULL);
+    CHECK_OCL(r, "clGetEventProfilingInfo");
+    r = clGetEventProfilingInfo(
+        e, CL_PROFILING_COMMAND_END, sizeof(t1), &t1, NULL);
+    CHECK_OCL(r, "clGetEventProfilingInfo");
 
-    cl_event e1;
-    r = clEnqueueNDRangeKernel(
-        rt_state.q, sampler, 2, NULL, (size_t[]){ height, width }, NULL,
-        1, (cl_event[]){ e0 }, &e1);
-    CHECK_OCL(r, "clEnqueueNDRangeKernel");
+    rt_release_event(&e);
+    return (t1 - t0)/1e6;
+}
 
-    r = clEnqueueReadBuffer(
-        rt_state.q, out, CL_TRUE, 0, N, buf,
-        1, (cl_event[]){ e1 }, NULL);
-    CHECK_OCL(r, "clEnqueueReadBuffer");
+// benchmarks both orderings of the range with the driver's local size and
+// with groups of 8 up to the kernel's maximum work-items in every
+// power-of-two shape, on the band's first rows, and caches the fastest
+static void rt_tune(struct rt_device* d, const struct rt_band* b, cl_event e0)
+{
+    const size_t W = rt_state.frame.width;
+    const size_t cols = MIN(W, d->tile);
+    const size_t rows = MIN(MIN(b->rows, d->tile/cols), 32);
+
+    // the band's world is written and the tile buffers are read back
+    cl_int r = clFlush(d->q_write); CHECK_OCL(r, "clFlush");
+    r = clWaitForEvents(1, &e0); CHECK_OCL(r, "clWaitForEvents");
+    r = clFinish(d->q_read); CHECK_OCL(r, "clFinish");
+    rt_device_arg(d, 3, sizeof(d->out[0]), &d->out[0]);
+
+    size_t max;
+    r = clGetKernelWorkGroupInfo(d->rt[0], d->id, CL_KERNEL_WORK_GROUP_SIZE,
+                                 sizeof(max), &max, NULL);
+    CHECK_OCL(r, "clGetKernelWorkGroupInfo");
+
+    // each ordering gets the same share of the candidates, the largest groups
+    // being dropped when the kernel's maximum is past what fits
+    struct rt_tune cs[128]; size_t m = 0;
+    const size_t per = LENGTH(cs)/LENGTH(d->rt);
+    for(cl_uint T = 0; T < LENGTH(d->rt); T++) {
+        const size_t end = m + per;
+        cs[m++] = (struct rt_tune){ .transposed = T };
+        for(size_t n = 8; n <= max && m < end; n *= 2) {
+            for(size_t a = 1; a <= n && m < end; a *= 2) {
+                cs[m++] = (struct rt_tune){ T, { a, n/a } };
+            }
+        }
+    }
+
+    // the first run pays for the kernel's warm-up
+    rt_tune_run(d, &cs[0], b->y0, rows, cols);
+
+    double best = INFINITY;
+    for(size_t j = 0; j < m; j++) {
+        const double ms = rt_tune_run(d, &cs[j], b->y0, rows, cols);
+        if(ms >= 0 && ms < best) { best = ms; d->tune = cs[j]; }
+    }
+    d->untuned = 0;
+
+    info("device %zu: tuned local size %zux%zu%s: %.3f ms for %zux%zu",
+         d - rt_state.devices, d->tune.local[0], d->tune.local[1],
+         d->tune.transposed ? " (transposed)" : "", best, rows, cols);
+
+    const char* dir = rt_cache_dir();
+    if(dir != NULL) {
+        rt_cache_store(dir, rt_tune_key(d), "tune",
+                       (const unsigned char*)&d->tune, sizeof(d->tune));
+    }
+}
+
+// n pixels from the pool, or new ones when it has none of that size: the
+// pooled pixels keep their mapped buffers
+static struct rt_pixels* rt_pixels_get(size_t n)
+{
+    int r = pthread_mutex_lock(&rt_state.pool.lock);
+    CHECK_IF(r != 0, "pthread_mutex_lock");
+    struct rt_pixels** q = &rt_state.pool.free;
+    while(*q != NULL && (*q)->n != n) q = &(*q)->next;
+    struct rt_pixels* px = *q;
+    if(px != NULL) *q = px->next;
+    r = pthread_mutex_unlock(&rt_state.pool.lock);
+    CHECK_IF(r != 0, "pthread_mutex_unlock");
+
+    if(px == NULL) {
+        px = calloc(sizeof(*px), 1);
+        CHECK_IF(px == NULL, "calloc");
+
+        // page aligned, as unified devices want their host pointers
+        const size_t P = 4096;
+        px->p = aligned_alloc(P, (sizeof(color_t)*n + P - 1)/P*P);
+        CHECK_IF(px->p == NULL, "aligned_alloc");
+        px->n = n;
+    }
+
+    atomic_init(&px->refs, 1); px->next = NULL;
+    return px;
+}
+
+// the buffers wrapping the pixels are released before the pixels, once the
+// devices are done with them
+static void rt_pixels_free(struct rt_pixels* px)
+{
+    for(size_t i = 0; i < LENGTH(px->host); i++) {
+        struct rt_mapping* m = &px->host[i];
+        if(m->unmap != NULL) {
+            cl_int r = clWaitForEvents(1, &m->unmap);
+            CHECK_OCL(r, "clWaitForEvents");
+            rt_release_event(&m->unmap);
+        }
+        rt_release(&m->mem);
+    }
+    free(px->p); free(px);
+}
+
+// frees the pooled pixels
+static void rt_pixels_drain(void)
+{
+    int r = pthread_mutex_lock(&rt_state.pool.lock);
+    CHECK_IF(r != 0, "pthread_mutex_lock");
+    struct rt_pixels* px = rt_state.pool.free; rt_state.pool.free = NULL;
+    r = pthread_mutex_unlock(&rt_state.pool.lock);
+    CHECK_IF(r != 0, "pthread_mutex_unlock");
+
+    while(px != NULL) {
+        struct rt_pixels* next = px->next;
+        rt_pixels_free(px); px = next;
+    }
+}
+
+void rt_ref(void* opaque)
+{
+    struct rt_pixels* px = opaque;
+    atomic_fetch_add(&px->refs, 1);
+}
+
+void rt_unref(void* opaque)
+{
+    struct rt_pixels* px = opaque;
+    if(atomic_fetch_sub(&px->refs, 1) != 1) return;
+
+    int r = pthread_mutex_lock(&rt_state.pool.lock);
+    CHECK_IF(r != 0, "pthread_mutex_lock");
+    px->next = rt_state.pool.free; rt_state.pool.free = px;
+    r = pthread_mutex_unlock(&rt_state.pool.lock);
+    CHECK_IF(r != 0, "pthread_mutex_unlock");
+}
+
+static size_t gcd(size_t a, size_t b)
+{
+    while(b != 0) { size_t t = a % b; a = b; b = t; }
+    return a;
+}
+
+static void rt_frame_args(struct rt_device* d)
+{
+    const struct rt_frame* f = &rt_state.frame;
+    const cl_ulong W = f->width, H = f->height, N = f->samples;
+    rt_device_arg(d, 4, sizeof(W), &W);
+    rt_device_arg(d, 5, sizeof(H), &H);
+    rt_device_arg(d, 6, sizeof(N), &N);
+}
+
+// appends node i of b and its subtree to the tree in depth-first order and
+// the spheres of its leaves to the tree's objects
+static void rt_flatten(struct rt_tree* t, const struct bvh* b, size_t i,
+                       const object_t spheres[])
+{
+    const bvh_node_t* n = &b->nodes[i];
+    const size_t j = t->nodes_len++;
+
+    bvh_skip_node_t* f = &t->nodes[j];
+    memcpy(f->lo, n->lo, sizeof(f->lo)); memcpy(f->hi, n->hi, sizeof(f->hi));
+    f->first = t->objects_len; f->count = n->count;
+    for(size_t k = 0; k < n->count; k++) {
+        t->objects[t->objects_len++] = spheres[b->slots[n->first + k]];
+    }
 
-    r = clReleaseMemObject(in); CHECK_OCL(r, "clReleaseMemObject");
-    r = clReleaseMemObject(data); CHECK_OCL(r, "clReleaseMemObject");
-    r = clReleaseMemObject(out); CHECK_OCL(r, "clReleaseMemObject");
+    if(n->count == 0) {
+        rt_flatten(t, b, n->first, spheres);
+        rt_flatten(t, b, n->first + 1, spheres);
+    }
+    t->nodes[j].skip = t->nodes_len;
+}
+
+static void rt_tree_build(struct rt_tree* t, const object_t spheres[],
+                          size_t n)
+{
+    free(t->nodes); free(t->objects);
+    t->nodes_len = 0; t->objects_len = 0;
+
+    if(n == 0) {
+        t->nodes = calloc(1, sizeof(bvh_skip_node_t));
+        t->objects = NULL;
+        CHECK_IF(t->nodes == NULL, "calloc");
+        t->nodes[0].skip = t->nodes_len = 1;
+        return;
+    }
+
+    float (*lo)[3] = malloc(sizeof(*lo)*n), (*hi)[3] = malloc(sizeof(*hi)*n);
+    CHECK_IF(lo == NULL || hi == NULL, "malloc");
+    for(size_t i = 0; i < n; i++) {
+        const sphere_t* s = &spheres[i].shape.sphere;
+        for(size_t k = 0; k < 3; k++) {
+            lo[i][k] = s->c.s[k] - s->r; hi[i][k] = s->c.s[k] + s->r;
+        }
+    }
+
+    // a leaf per sphere, the spheres are tested one by one
+    struct bvh* b = bvh_build((const float (*)[3])lo, (const float (*)[3])hi,
+                              n, 1);
+    free(lo); free(hi);
+
+    t->nodes = malloc(sizeof(bvh_skip_node_t)*b->nodes_len);
+    t->objects = malloc(sizeof(object_t)*b->slots_len);
+    CHECK_IF(t->nodes == NULL || t->objects == NULL, "malloc");
+    rt_flatten(t, b, 0, spheres);
+
+    info("rt_tree: %zu spheres in %zu nodes, depth %zu",
+         n, t->nodes_len, b->depth);
+    bvh_free(b);
+}
+
+// the world's spheres are moved into the tree, which is rebuilt when they
+// differ from the last world's: returns the world without them, valid until
+// the next call
+static const world_t* rt_tree(const world_t* w)
+{
+    struct rt_tree* t = &rt_state.tree;
 
-    r = clReleaseKernel(sampler); CHECK_OCL(r, "clReleaseKernel");
-    r = clReleaseKernel(rt); CHECK_OCL(r, "clReleaseKernel");
+    // the objects' unique seeds differ between the frames of a scene
+    uint64_t h = 0xcbf29ce484222325; size_t n = 0;
+    for(size_t i = 0; !t->disabled && i < w->objects_len; i++) {
+        const object_t* o = &w->objects[i];
+        if(o->shape_type != SHAPE_TYPE_SPHERE) continue;
+        h = rt_hash(h, o->shape.sphere.c.s, 3*sizeof(cl_float));
+        h = rt_hash(h, &o->shape.sphere.r, sizeof(o->shape.sphere.r));
+        h = rt_hash(h, &o->material.color, sizeof(o->material.color));
+        h = rt_hash(h, &o->material.light, sizeof(o->material.light));
+        h = rt_hash(h, &o->material.disperse, sizeof(o->material.disperse));
+        n++;
+    }
+
+    if(t->nodes == NULL || h != t->hash) {
+        stopwatch_start(rt_state.stopwatch_tree);
+        object_t* ss = malloc(sizeof(object_t)*MAX(n, 1));
+        CHECK_IF(ss == NULL, "malloc");
+        for(size_t i = 0, j = 0; j < n; i++) {
+            if(w->objects[i].shape_type == SHAPE_TYPE_SPHERE) {
+                ss[j++] = w->objects[i];
+            }
+        }
+
+        // the devices' writes of the previous tree are blocking
+        rt_tree_build(t, ss, n);
+        free(ss); t->hash = h;
+        stopwatch_stop(rt_state.stopwatch_tree);
+    }
+
+    const size_t L = w->objects_len - n;
+    if(world_size_with_objects(L) > t->world_size) {
+        free(t->world); t->world_size = world_size_with_objects(L);
+        t->world = malloc(t->world_size); CHECK_IF(t->world == NULL, "malloc");
+    }
+    memcpy(t->world, w, sizeof(world_t));
+    t->world->objects_len = L;
+    for(size_t i = 0, j = 0; j < L; i++) {
+        const object_t* o = &w->objects[i];
+        if(t->disabled || o->shape_type != SHAPE_TYPE_SPHERE) {
+            t->world->objects[j++] = *o;
+        }
+    }
+    return t->world;
+}
+
+// writes the tree to the device when it has changed since the last write,
+// once the device's kernels using the last one are done
+static void rt_tree_write(struct rt_device* d)
+{
+    const struct rt_tree* t = &rt_state.tree;
+    if(d->nodes == NULL || d->tree != t->hash) {
+        cl_int r = clFinish(d->q); CHECK_OCL(r, "clFinish");
+
+        const size_t N = sizeof(bvh_skip_node_t)*t->nodes_len;
+        const size_t O = sizeof(object_t)*t->objects_len;
+        rt_buffer_fit(d, &d->nodes, &d->nodes_size,
+                      CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, N);
+        rt_buffer_fit(d, &d->objects, &d->objects_size,
+                      CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                      MAX(O, sizeof(object_t)));
+
+        r = clEnqueueWriteBuffer(d->q_write, d->nodes, CL_TRUE, 0, N,
+                                 t->nodes, 0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueWriteBuffer");
+        if(O > 0) {
+            r = clEnqueueWriteBuffer(d->q_write, d->objects, CL_TRUE, 0, O,
+                                     t->objects, 0, NULL, NULL);
+            CHECK_OCL(r, "clEnqueueWriteBuffer");
+        }
+        d->tree = t->hash;
+    }
+}
+
+#define RT_SPECIALIZE_OBJECTS_MAX 64
+
+// the world's object count, shapes and materials as the definitions that
+// specialize rt.cl, or NULL when there are too many objects to unroll: the
+// world is rt_tree's, so unless RT_BVH=0 its objects are only the planes
+static char* rt_scene_source(const world_t* w)
+{
+    const size_t O = w->objects_len;
+    if(O == 0 || O > RT_SPECIALIZE_OBJECTS_MAX) return NULL;
+
+    const size_t n = 256 + 160*O;
+    char* s = malloc(n); CHECK_IF(s == NULL, "malloc");
+
+    size_t o = snprintf(s, n, "\n#define RT_OBJECTS %zu\n"
+                        "__constant shape_type_t rt_shapes[] = {", O);
+    for(size_t i = 0; i < O; i++) {
+        o += snprintf(s + o, n - o, "%s%d", i == 0 ? " " : ", ",
+                      (int)w->objects[i].shape_type);
+    }
+
+    o += snprintf(s + o, n - o,
+                  " };\n__constant material_t rt_materials[] = {\n");
+    for(size_t i = 0; i < O; i++) {
+        const material_t* m = &w->objects[i].material;
+        o += snprintf(s + o, n - o,
+                      "    { { %u, %u, %u }, { %u, %u, %u }, %"PRIu64"UL },\n",
+                      m->color.r, m->color.g, m->color.b,
+                      m->light.r, m->light.g, m->light.b, m->disperse);
+    }
+    snprintf(s + o, n - o, "};\n");
+
+    return s;
+}
+
+// builds the platforms' programs specialized to the world's scene when it
+// differs from the last one's, their binaries are cached by the scene: the
+// devices' kernels are then recreated by rt_frame_mk
+static void rt_specialize(const world_t* w)
+{
+    if(!rt_state.specialize) return;
+
+    char* spec = rt_scene_source(w);
+    if(spec == NULL) {
+        info("not specializing to a scene of %zu objects", w->objects_len);
+        rt_state.specialize = 0;
+        return;
+    }
+
+    const uint64_t h = rt_hash(0xcbf29ce484222325, spec, strlen(spec));
+    if(h == rt_state.scene) { free(spec); return; }
+
+    stopwatch_start(rt_state.stopwatch_specialize);
+    for(size_t i = 0; i < rt_state.platforms_len; i++) {
+        struct rt_platform* pl = &rt_state.platforms[i];
+
+        uint64_t keys[RT_DEVICES_MAX];
+        for(size_t j = 0; j < pl->ds; j++) {
+            keys[j] = rt_hash(pl->keys[j], spec, strlen(spec));
+        }
+
+        cl_program p = rt_program_from_cache(pl, keys);
+        if(p == NULL) {
+            p = rt_program_from_source(pl, spec);
+            cl_int r = clBuildProgram(p, pl->ds, pl->ids, pl->flags,
+                                      NULL, NULL);
+            rt_build_callback(p, NULL);
+            CHECK_OCL(r, "clBuildProgram");
+            rt_program_store(pl, p, keys);
+        }
+
+        if(pl->spec != NULL) {
+            cl_int r = clReleaseProgram(pl->spec);
+            CHECK_OCL(r, "clReleaseProgram");
+        }
+        pl->spec = p;
+    }
+
+    // the frames in flight hold on to the kernels they were enqueued with,
+    // the other draws' kernels are created again on their next use
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        cl_kernel* ks[] = {
+            &d->rt[0], &d->rt[1], &d->batch, &d->acc, &d->resolve,
+            &d->generate, &d->intersect, &d->shade, &d->accumulate,
+            &d->adaptive, &d->resolve_adaptive,
+        };
+        for(size_t j = 0; j < LENGTH(ks); j++) {
+            if(*ks[j] == NULL) continue;
+            cl_int r = clReleaseKernel(*ks[j]);
+            CHECK_OCL(r, "clReleaseKernel");
+            *ks[j] = NULL;
+        }
+    }
+
+    info("specialized the program to a scene of %zu objects", w->objects_len);
+    rt_state.scene = h; free(spec);
+    stopwatch_stop(rt_state.stopwatch_specialize);
+}
+
+static void rt_frame_mk(size_t width, size_t height, size_t samples)
+{
+    struct rt_frame* f = &rt_state.frame; cl_int r;
+
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        if(d->rt[0] != NULL) continue;
+
+        const cl_program p = d->pl->spec ? d->pl->spec : rt_program(d->pl);
+        const char* ks[] = { "rt_ray_trace", "rt_ray_trace_t" };
+        for(size_t j = 0; j < LENGTH(d->rt); j++) {
+            d->rt[j] = clCreateKernel(p, ks[j], &r);
+            CHECK_OCL(r, "clCreateKernel(%s)", ks[j]);
+        }
+        if(f->width != 0) rt_frame_args(d);
+    }
+
+    if(width == f->width && height == f->height && samples == f->samples) {
+        return;
+    }
+
+    if(f->submitted != f->collected) {
+        failwith("frame size changed with %zu frames in flight",
+                 f->submitted - f->collected);
+    }
+
+    debug("frame: %zux%zu samples=%zu", width, height, samples);
+    f->width = width; f->height = height; f->samples = samples;
+
+    // the slots' pixels are allocated by rt_submit, rt_draw needs none
+    for(size_t i = 0; i < f->depth; i++) {
+        struct rt_slot* s = &f->slots[i];
+        if(s->px != NULL) { rt_unref(s->px); s->px = NULL; }
+    }
+    rt_pixels_drain();
+
+    f->align = 1;
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        if(!rt_state.devices[i].unified) continue;
+        const size_t R = sizeof(color_t)*width, P = 4096;
+        const size_t g = P/gcd(R, P);
+        if(g*rt_state.devices_len <= height) f->align = g;
+    }
+
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        rt_frame_args(d);
+        rt_tune_load(d);
+
+        for(size_t j = 0; j < LENGTH(d->out); j++) {
+            rt_release(&d->out[j]); rt_release_event(&d->read[j]);
+            d->out[j] = rt_buffer(d, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                                  sizeof(color_t)*MIN(d->tile, width*height));
+        }
+    }
+}
+
+// splits n units at the devices' cumulative rates, device i getting us[i] up
+// to us[i + 1]: every device gets one (when there are enough) so that its
+// rate keeps being measured
+static void rt_split_units(size_t n, size_t us[])
+{
+    const size_t D = rt_state.devices_len;
+
+    double total = 0;
+    for(size_t i = 0; i < D; i++) total += rt_state.devices[i].rate;
+
+    double acc = 0; us[0] = 0;
+    for(size_t i = 0; i < D; i++) {
+        acc += rt_state.devices[i].rate;
+        size_t e = i + 1 == D ? n : llround(n*acc/total);
+        if(n >= D) e = MIN(MAX(e, us[i] + 1), n - (D - i - 1));
+        us[i + 1] = MAX(e, us[i]);
+    }
+}
+
+// splits the frame's rows in multiples of the frame's align rows
+static void rt_split(struct rt_band bs[], size_t height)
+{
+    const size_t g = rt_state.frame.align;
+    size_t us[RT_DEVICES_MAX + 1];
+    rt_split_units((height + g - 1)/g, us);
+
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        bs[i].y0 = MIN(us[i]*g, height);
+        bs[i].rows = MIN(us[i + 1]*g, height) - bs[i].y0;
+    }
+}
+
+void rt_deinitialize(void)
+{
+    struct rt_frame* f = &rt_state.frame;
+    for(size_t i = 0; i < f->depth; i++) {
+        if(f->slots[i].px != NULL) rt_unref(f->slots[i].px);
+    }
+    rt_pixels_drain();
+
+    struct rt_tree* t = &rt_state.tree;
+    free(t->world); free(t->nodes); free(t->objects);
+
+    if(rt_state.native) return;
+
+    for(size_t i = 0; i < f->depth; i++) {
+        struct rt_slot* s = &f->slots[i];
+        for(size_t j = 0; j < rt_state.devices_len; j++) {
+            struct rt_band* b = &s->bands[j];
+            rt_release(&b->in);
+        }
+        free(s->world);
+    }
+
+    cl_int r;
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        for(size_t j = 0; j < LENGTH(d->out); j++) {
+            rt_release(&d->out[j]); rt_release_event(&d->read[j]);
+        }
+
+        rt_release(&d->batch_in); rt_release(&d->batch_views);
+        rt_release(&d->batch_out);
+        for(size_t j = 0; j < d->sums_len; j++) rt_release(&d->sums[j]);
+        free(d->sums);
+        rt_release(&d->nodes); rt_release(&d->objects);
+        rt_release(&d->paths); rt_release(&d->count);
+        rt_release(&d->queues[0]); rt_release(&d->queues[1]);
+        rt_release(&d->stats);
+        cl_kernel ks[] = {
+            d->batch, d->acc, d->resolve,
+            d->generate, d->intersect, d->shade, d->accumulate,
+            d->adaptive, d->resolve_adaptive,
+        };
+        for(size_t j = 0; j < LENGTH(ks); j++) {
+            if(ks[j] == NULL) continue;
+            r = clReleaseKernel(ks[j]); CHECK_OCL(r, "clReleaseKernel");
+        }
+        for(size_t j = 0; j < LENGTH(d->rt); j++) {
+            if(d->rt[j] == NULL) continue;
+            r = clReleaseKernel(d->rt[j]); CHECK_OCL(r, "clReleaseKernel");
+        }
+
+        cl_command_queue qs[] = { d->q, d->q_write, d->q_read };
+        for(size_t j = 0; j < LENGTH(qs); j++) {
+            r = clReleaseCommandQueue(qs[j]);
+            CHECK_OCL(r, "clReleaseCommandQueue");
+        }
+    }
+
+    for(size_t i = 0; i < rt_state.platforms_len; i++) {
+        struct rt_platform* pl = &rt_state.platforms[i];
+        r = clReleaseProgram(rt_program(pl)); CHECK_OCL(r, "clReleaseProgram");
+        if(pl->spec != NULL) {
+            r = clReleaseProgram(pl->spec); CHECK_OCL(r, "clReleaseProgram");
+        }
+        r = clReleaseContext(pl->ctx); CHECK_OCL(r, "clReleaseContext");
+    }
+}
+
+void rt_run(void)
+{
+    if(rt_state.native) return;
+
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        cl_command_queue qs[] = { d->q_write, d->q, d->q_read };
+        for(size_t j = 0; j < LENGTH(qs); j++) {
+            cl_int r = clFinish(qs[j]); CHECK_OCL(r, "clFinish");
+        }
+    }
+}
+
+size_t rt_frames_in_flight(void)
+{
+    return rt_state.frame.depth;
+}
+
+size_t rt_in_flight(void)
+{
+    return rt_state.frame.submitted - rt_state.frame.collected;
+}
+
+// traces the tile of rows and cols pixels at y, x into the device's next
+// output buffer and reads it back to the slot's destination
+static void rt_submit_tile(struct rt_device* d, struct rt_slot* s,
+                           struct rt_band* b, cl_event e0,
+                           size_t y, size_t x, size_t rows, size_t cols)
+{
+    const size_t W = rt_state.frame.width, i = d->tiles++ % LENGTH(d->out);
+
+    // the argument is captured when the kernel is enqueued
+    rt_device_arg(d, 3, sizeof(d->out[i]), &d->out[i]);
+
+    // the buffer is reused once its previous tile has been read back
+    cl_event ws[2] = { e0, d->read[i] }, k;
+    cl_int r = rt_enqueue(d, &d->tune, y, x, rows, cols,
+                          ws[1] == NULL ? 1 : 2, ws, &k);
+    CHECK_OCL(r, "clEnqueueNDRangeKernel");
+
+    rt_release_event(&d->read[i]);
+    r = clEnqueueReadBufferRect(
+        d->q_read, d->out[i], CL_FALSE,
+        (size_t[]){ 0, 0, 0 }, (size_t[]){ x*sizeof(color_t), y, 0 },
+        (size_t[]){ cols*sizeof(color_t), rows, 1 },
+        cols*sizeof(color_t), 0, W*sizeof(color_t), 0,
+        s->dst, 1, &k, &d->read[i]);
+    CHECK_OCL(r, "clEnqueueReadBufferRect");
+
+    if(b->first == NULL) {
+        b->first = k;
+    } else {
+        rt_release_event(&b->last); b->last = k;
+    }
+
+    rt_release_event(&b->read);
+    r = clRetainEvent(d->read[i]); CHECK_OCL(r, "clRetainEvent");
+    b->read = d->read[i];
+}
+
+// traces the band straight into the slot's pixels, which the device shares:
+// the mapping synchronizes them for the host without a copy
+static void rt_submit_mapped(struct rt_device* d, struct rt_slot* s,
+                             struct rt_band* b, cl_event e0)
+{
+    const size_t W = rt_state.frame.width;
+    const size_t o = sizeof(color_t)*b->y0*W, n = sizeof(color_t)*b->rows*W;
+    struct rt_mapping* m = &s->px->host[d - rt_state.devices];
+
+    // a released buffer lives until its unmapping, which the kernel waits for
+    cl_int r;
+    if(m->mem == NULL || m->o != o || m->n != n) {
+        rt_release(&m->mem);
+        m->mem = clCreateBuffer(
+            d->pl->ctx, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR
+            | CL_MEM_HOST_READ_ONLY, n, (char*)s->px->p + o, &r);
+        CHECK_OCL(r, "clCreateBuffer(%zu)", n);
+        m->o = o; m->n = n;
+    }
+
+    rt_device_arg(d, 3, sizeof(m->mem), &m->mem);
+
+    // the kernel writes the buffer once its previous mapping is gone
+    cl_event ws[2] = { e0, m->unmap };
+    r = rt_enqueue(d, &d->tune, b->y0, 0, b->rows, W,
+                   ws[1] == NULL ? 1 : 2, ws, &b->first);
+    CHECK_OCL(r, "clEnqueueNDRangeKernel");
+    rt_release_event(&m->unmap);
+
+    b->mapped = clEnqueueMapBuffer(
+        d->q_read, m->mem, CL_FALSE, CL_MAP_READ, 0, n,
+        1, &b->first, &b->read, &r);
+    CHECK_OCL(r, "clEnqueueMapBuffer");
+}
+
+static void rt_submit_band(struct rt_device* d, struct rt_slot* s,
+                           struct rt_band* b)
+{
+    const size_t W = rt_state.frame.width;
+
+    if(world_size(s->world) > b->in_size) {
+        rt_release(&b->in); b->in_size = world_size(s->world);
+        b->in = rt_buffer(d, CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                          b->in_size);
+    }
+
+    cl_event e0;
+    cl_int r = clEnqueueWriteBuffer(
+        d->q_write, b->in, CL_FALSE, 0, world_size(s->world), s->world,
+        0, NULL, &e0);
+    CHECK_OCL(r, "clEnqueueWriteBuffer");
+
+    rt_tree_write(d);
+    rt_device_arg(d, 0, sizeof(b->in), &b->in);
+    rt_device_arg(d, 1, sizeof(d->nodes), &d->nodes);
+    rt_device_arg(d, 2, sizeof(d->objects), &d->objects);
+    if(d->untuned) rt_tune(d, b, e0);
+
+    // whole rows when a tile holds a row, otherwise the rows' spans: only
+    // the slot's own pixels are mapped, a caller's buffer is read back to
+    if(d->unified && b->rows*W <= d->tile
+       && s->px != NULL && s->dst == s->px->p) {
+        rt_submit_mapped(d, s, b, e0);
+    } else if(d->tile >= W) {
+        const size_t rows = d->tile/W;
+        for(size_t y = b->y0; y < b->y0 + b->rows; y += rows) {
+            rt_submit_tile(d, s, b, e0,
+                           y, 0, MIN(rows, b->y0 + b->rows - y), W);
+        }
+    } else {
+        for(size_t y = b->y0; y < b->y0 + b->rows; y++) {
+            for(size_t x = 0; x < W; x += d->tile) {
+                rt_submit_tile(d, s, b, e0, y, x, 1, MIN(d->tile, W - x));
+            }
+        }
+    }
+
+    rt_release_event(&e0);
+
+    // the queues are flushed so that the device starts on the band while
+    // the host prepares the next one
+    cl_command_queue qs[] = { d->q_write, d->q, d->q_read };
+    for(size_t i = 0; i < LENGTH(qs); i++) {
+        r = clFlush(qs[i]); CHECK_OCL(r, "clFlush");
+    }
+}
+
+// the frame is read back to dst, or the slot's buffer when it is NULL
+static void rt_submit_to(const world_t* w, size_t width, size_t height,
+                         size_t samples, color_t* dst)
+{
+    struct rt_frame* f = &rt_state.frame;
+    if(rt_in_flight() >= f->depth) {
+        failwith("%zu frames already in flight", rt_in_flight());
+    }
+
+    stopwatch_start(rt_state.stopwatch_setup);
+    w = rt_tree(w);
+    if(!rt_state.native) rt_specialize(w);
+    rt_frame_mk(width, height, samples);
+    struct rt_slot* s = &f->slots[f->submitted++ % f->depth];
+
+    if(dst == NULL) {
+        // the pixels are still referenced by whoever collected them last,
+        // they return to the pool when released
+        if(s->px != NULL && atomic_load(&s->px->refs) > 1) {
+            rt_unref(s->px); s->px = NULL;
+        }
+        if(s->px == NULL) s->px = rt_pixels_get(width*height);
+        dst = s->px->p;
+    }
+    s->dst = dst;
+
+    if(rt_state.native) {
+        stopwatch_stop(rt_state.stopwatch_setup);
+        native_draw(w, rt_state.tree.nodes, rt_state.tree.objects,
+                    width, height, samples, s->dst);
+        return;
+    }
+
+    // the world is copied since the writes complete after the caller's
+    // world is gone, the slot is reused only after it has been collected
+    if(world_size(w) > s->world_size) {
+        free(s->world); s->world_size = world_size(w);
+        s->world = malloc(s->world_size); CHECK_IF(s->world == NULL, "malloc");
+    }
+    memcpy(s->world, w, world_size(w));
+
+    rt_split(s->bands, height);
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        if(s->bands[i].rows == 0) continue;
+        rt_submit_band(&rt_state.devices[i], s, &s->bands[i]);
+    }
+
+    stopwatch_stop(rt_state.stopwatch_setup);
+}
+
+// queues the tracing of a frame without waiting for it: at most
+// rt_frames_in_flight frames can be submitted before the oldest is collected
+void rt_submit(const world_t* w, size_t width, size_t height, size_t samples)
+{
+    rt_submit_to(w, width, height, samples, NULL);
+}
+
+// the kernels' time of a band in ms, or a negative number when the device
+// could not say
+static double rt_band_ms(const struct rt_band* b)
+{
+    cl_ulong t0, t1;
+    cl_int r = clGetEventProfilingInfo(
+        b->first, CL_PROFILING_COMMAND_START, sizeof(t0), &t0, NULL);
+    if(r != CL_SUCCESS) return -1;
+
+    r = clGetEventProfilingInfo(
+        b->last != NULL ? b->last : b->first,
+        CL_PROFILING_COMMAND_END, sizeof(t1), &t1, NULL);
+    if(r != CL_SUCCESS || t1 <= t0) return -1;
+
+    return (t1 - t0)/1e6;
+}
+
+static void rt_measure(struct rt_device* d, size_t rows, double ms)
+{
+    if(ms <= 0) return;
+
+    const double rate = rows/ms;
+    d->rate = d->measured ? (d->rate + rate)/2 : rate;
+    d->measured = 1;
+    debug("device %zu: %zu rows in %.3f ms (%.3f rows/ms)",
+          d - rt_state.devices, rows, ms, d->rate);
+}
+
+static struct rt_slot* rt_wait(void)
+{
+    struct rt_frame* f = &rt_state.frame;
+    if(rt_in_flight() == 0) { failwith("no frames in flight"); }
+    struct rt_slot* s = &f->slots[f->collected++ % f->depth];
+
+    for(size_t i = 0; !rt_state.native && i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        struct rt_band* b = &s->bands[i];
+        if(b->rows == 0) continue;
+
+        cl_int r = clWaitForEvents(1, &b->read);
+        CHECK_OCL(r, "clWaitForEvents");
+
+        rt_measure(d, b->rows, rt_band_ms(b));
+
+        rt_release_event(&b->first);
+        rt_release_event(&b->last);
+        rt_release_event(&b->read);
+
+        // the pixels are in place: nothing writes them until the slot is
+        // submitted again, which waits for the unmapping
+        if(b->mapped != NULL) {
+            struct rt_mapping* m = &s->px->host[i];
+            r = clEnqueueUnmapMemObject(
+                d->q_read, m->mem, b->mapped, 0, NULL, &m->unmap);
+            CHECK_OCL(r, "clEnqueueUnmapMemObject");
+            r = clFlush(d->q_read); CHECK_OCL(r, "clFlush");
+            b->mapped = NULL;
+        }
+    }
+
+    return s;
+}
+
+// waits for the oldest frame in flight and copies it to buf, the frames are
+// collected in the order they were submitted
+void rt_collect(color_t buf[])
+{
+    stopwatch_start(rt_state.stopwatch_collect);
+    struct rt_slot* s = rt_wait();
+
+    const struct rt_frame* f = &rt_state.frame;
+    if(buf != s->dst) {
+        memcpy(buf, s->dst, sizeof(color_t)*f->width*f->height);
+    }
+    stopwatch_stop(rt_state.stopwatch_collect);
+}
+
+// rt_collect without the copy: the pixels stay valid until rt_unref(*ref)
+const color_t* rt_collect_ref(void** ref)
+{
+    stopwatch_start(rt_state.stopwatch_collect);
+    struct rt_slot* s = rt_wait();
+    if(s->px == NULL || s->dst != s->px->p) {
+        failwith("rt_collect_ref of a frame drawn by rt_draw");
+    }
+
+    rt_ref(s->px); *ref = s->px;
+    stopwatch_stop(rt_state.stopwatch_collect);
+    return s->dst;
+}
+
+void rt_draw(const world_t* w, size_t width, size_t height, size_t samples,
+             color_t buf[])
+{
+    stopwatch_start(rt_state.stopwatch_draw);
+    rt_submit_to(w, width, height, samples, buf);
+    rt_collect(buf);
+    stopwatch_stop(rt_state.stopwatch_draw);
+}
+
+// the kernel n, created on first use from the program specialized to the
+// scene when there is one
+static cl_kernel rt_kernel(struct rt_device* d, cl_kernel* k, const char* n)
+{
+    if(*k == NULL) {
+        const cl_program p = d->pl->spec ? d->pl->spec : rt_program(d->pl);
+        cl_int r; *k = clCreateKernel(p, n, &r);
+        CHECK_OCL(r, "clCreateKernel(%s)", n);
+    }
+    return *k;
+}
+
+// traces frames of the world, frame k seen from views[k] and numbered the
+// world's frame plus k, into frames*width*height pixels that stay valid
+// until rt_unref(*ref): the world is written once and each device traces its
+// share of the frames in as few dispatches as its tiles allow
+const color_t* rt_draw_batch(const world_t* w, const view_t views[],
+                             size_t frames, size_t width, size_t height,
+                             size_t samples, void** ref)
+{
+    if(rt_in_flight() > 0) {
+        failwith("rt_draw_batch with %zu frames in flight", rt_in_flight());
+    }
+
+    stopwatch_start(rt_state.stopwatch_draw);
+    const size_t P = width*height;
+    struct rt_pixels* px = rt_pixels_get(frames*P); *ref = px;
+    w = rt_tree(w);
+    if(!rt_state.native) rt_specialize(w);
+
+    if(rt_state.native) {
+        native_draw_batch(w, rt_state.tree.nodes, rt_state.tree.objects,
+                          views, frames, width, height, samples, px->p);
+        stopwatch_stop(rt_state.stopwatch_draw);
+        return px->p;
+    }
+
+    size_t us[RT_DEVICES_MAX + 1]; rt_split_units(frames, us);
+    struct rt_band bs[RT_DEVICES_MAX] = { 0 };
+
+    const cl_ulong W = width, H = height, N = samples;
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        if(us[i] == us[i + 1]) continue;
+
+        rt_kernel(d, &d->batch, "rt_ray_trace_batch");
+
+        if(P > d->tile) {
+            failwith("device %zu: a %zux%zu frame does not fit a tile",
+                     i, width, height);
+        }
+        const size_t F = MIN(d->tile/P, us[i + 1] - us[i]);
+
+        rt_buffer_fit(d, &d->batch_in, &d->batch_in_size,
+                      CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                      world_size(w));
+        rt_buffer_fit(d, &d->batch_views, &d->batch_views_size,
+                      CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                      sizeof(view_t)*frames);
+        rt_buffer_fit(d, &d->batch_out, &d->batch_out_size,
+                      CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                      sizeof(color_t)*F*P);
+
+        // the writes, dispatches and reads are ordered by the kernel's queue
+        cl_int r = clEnqueueWriteBuffer(d->q, d->batch_in, CL_FALSE, 0,
+                                        world_size(w), w, 0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueWriteBuffer");
+        r = clEnqueueWriteBuffer(d->q, d->batch_views, CL_FALSE, 0,
+                                 sizeof(view_t)*frames, views, 0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueWriteBuffer");
+
+        rt_tree_write(d);
+        rt_kernel_arg(d->batch, 0, sizeof(d->batch_in), &d->batch_in);
+        rt_kernel_arg(d->batch, 1, sizeof(d->nodes), &d->nodes);
+        rt_kernel_arg(d->batch, 2, sizeof(d->objects), &d->objects);
+        rt_kernel_arg(d->batch, 3, sizeof(d->batch_views), &d->batch_views);
+        rt_kernel_arg(d->batch, 4, sizeof(d->batch_out), &d->batch_out);
+        rt_kernel_arg(d->batch, 5, sizeof(W), &W);
+        rt_kernel_arg(d->batch, 6, sizeof(H), &H);
+        rt_kernel_arg(d->batch, 7, sizeof(N), &N);
+
+        struct rt_band* b = &bs[i];
+        for(size_t k = us[i]; k < us[i + 1]; k += F) {
+            const size_t n = MIN(F, us[i + 1] - k);
+            cl_event e;
+            r = clEnqueueNDRangeKernel(
+                d->q, d->batch, 3, (size_t[]){ k, 0, 0 },
+                (size_t[]){ n, height, width }, NULL, 0, NULL, &e);
+            CHECK_OCL(r, "clEnqueueNDRangeKernel");
+
+            if(b->first == NULL) b->first = e;
+            else { rt_release_event(&b->last); b->last = e; }
+
+            r = clEnqueueReadBuffer(d->q, d->batch_out, CL_FALSE, 0,
+                                    sizeof(color_t)*n*P, px->p + k*P,
+                                    0, NULL, NULL);
+            CHECK_OCL(r, "clEnqueueReadBuffer");
+        }
+
+        r = clFlush(d->q); CHECK_OCL(r, "clFlush");
+    }
+
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        struct rt_band* b = &bs[i];
+        if(b->first == NULL) continue;
+
+        cl_int r = clFinish(d->q); CHECK_OCL(r, "clFinish");
+        rt_measure(d, (us[i + 1] - us[i])*height, rt_band_ms(b));
+        rt_release_event(&b->first); rt_release_event(&b->last);
+    }
+
+    stopwatch_stop(rt_state.stopwatch_draw);
+    return px->p;
+}
+
+static double rt_now_ms(void)
+{
+    struct timespec ts;
+    int r = clock_gettime(CLOCK_MONOTONIC, &ts);
+    CHECK(r, "clock_gettime");
+    return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+// the smallest stride past a row of the samples' grid that is coprime with
+// N, so that every sample is visited
+static size_t rt_sample_stride(size_t N)
+{
+    size_t s = (size_t)sqrt(N - 1) + 1;
+    while(gcd(s, N) != 1) s++;
+    return s;
+}
+
+// a band's tiles of T pixels, as rt_submit_band cuts them: whole rows when
+// a tile holds a row, otherwise the rows' spans
+static size_t rt_band_tiles(const struct rt_band* b, size_t W, size_t T)
+{
+    if(T >= W) return (b->rows + T/W - 1)/(T/W);
+    return b->rows*((W + T - 1)/T);
+}
+
+// the offset o and size g (rows, columns) of the band's tile k
+static void rt_band_tile(const struct rt_band* b, size_t W, size_t T,
+                         size_t k, size_t o[2], size_t g[2])
+{
+    if(T >= W) {
+        const size_t R = T/W;
+        o[0] = b->y0 + k*R; o[1] = 0;
+        g[0] = MIN(R, b->y0 + b->rows - o[0]); g[1] = W;
+    } else {
+        const size_t S = (W + T - 1)/T;
+        o[0] = b->y0 + k/S; o[1] = (k % S)*T;
+        g[0] = 1; g[1] = MIN(T, W - o[1]);
+    }
+}
+
+// the pixels of the device's tiles of running sums, which take as many
+// bytes as its tiles of pixels
+static size_t rt_sums_tile(const struct rt_device* d)
+{
+    return MAX(d->tile*sizeof(color_t)/(3*sizeof(cl_uint)), 1);
+}
+
+// traces the samples n0 up to n1 of the devices' bands a tile at a time and
+// adds each device's kernel ms to ms[i], returns the slowest device's
+static double rt_budget_batch(struct rt_band bs[], double ms[], size_t W,
+                              size_t n0, size_t n1)
+{
+    const cl_ulong A = n0, B = n1;
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_device* d = &rt_state.devices[i];
+        struct rt_band* b = &bs[i];
+        if(b->rows == 0) continue;
+
+        rt_kernel_arg(d->acc, 7, sizeof(A), &A);
+        rt_kernel_arg(d->acc, 8, sizeof(B), &B);
+
+        const size_t T = rt_sums_tile(d);
+        for(size_t k = 0; k < rt_band_tiles(b, W, T); k++) {
+            size_t o[2], g[2]; rt_band_tile(b, W, T, k, o, g);
+            rt_kernel_arg(d->acc, 3, sizeof(d->sums[k]), &d->sums[k]);
+
+            cl_event e;
+            cl_int r = clEnqueueNDRangeKernel(d->q, d->acc, 2, o, g,
+                                              NULL, 0, NULL, &e);
+            CHECK_OCL(r, "clEnqueueNDRangeKernel");
+            if(b->first == NULL) b->first = e;
+            else { rt_release_event(&b->last); b->last = e; }
+        }
+        cl_int r = clFlush(d->q); CHECK_OCL(r, "clFlush");
+    }
+
+    double slowest = 0;
+    for(size_t i = 0; i < rt_state.devices_len; i++) {
+        struct rt_band* b = &bs[i];
+        if(b->rows == 0) continue;
+
+        cl_event e = b->last != NULL ? b->last : b->first;
+        cl_int r = clWaitForEvents(1, &e);
+        CHECK_OCL(r, "clWaitForEvents");
+        const double t = MAX(rt_band_ms(b), 0);
+        ms[i] += t; slowest = MAX(slowest, t);
+        rt_release_event(&b->first); rt_release_event(&b->last);
+    }
+    return slowest;
+}
+
+// rt_draw within a deadline of ms: the samples are traced in batches into
+// running sums, the batches doubling while the time per sample of the last
+// one says that the next one fits in what is left of the deadline; returns
+// the samples traced, at least one and at most samples
+size_t rt_draw_budget(const world_t* w, size_t width, size_t height,
+                      size_t samples, double ms, color_t buf[])
+{
+    if(rt_in_flight() > 0) {
+        failwith("rt_draw_budget with %zu frames in flight", rt_in_flight());
+    }
+
+    stopwatch_start(rt_state.stopwatch_draw);
+    const double t0 = rt_now_ms();
+    const cl_ulong W = width, H = height, N = samples;
+    const cl_ulong stride = rt_sample_stride(samples);
+    w = rt_tree(w);
+    if(!rt_state.native) rt_specialize(w);
+
+    unsigned int* sums = NULL;
+    struct rt_band bs[RT_DEVICES_MAX] = { 0 };
+    double dms[RT_DEVICES_MAX] = { 0 };
+    if(rt_state.native) {
+        sums = malloc(3*sizeof(*sums)*width*height);
+        CHECK_IF(sums == NULL, "malloc");
+    } else {
+        size_t us[RT_DEVICES_MAX + 1]; rt_split_units(height, us);
+        for(size_t i = 0; i < rt_state.devices_len; i++) {
+            struct rt_device* d = &rt_state.devices[i];
+            struct rt_band* b = &bs[i];
+            b->y0 = us[i]; b->rows = us[i + 1] - us[i];
+            if(b->rows == 0) continue;
+
+            rt_kernel(d, &d->acc, "rt_ray_trace_acc");
+            rt_kernel(d, &d->resolve, "rt_resolve");
+
+            rt_buffer_fit(d, &d->batch_in, &d->batch_in_size,
+                          CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                          world_size(w));
+            const size_t T = rt_sums_tile(d);
+            rt_buffers_fit(d, &d->sums, &d->sums_len, &d->sums_size,
+                           CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+                           rt_band_tiles(b, width, T),
+                           3*sizeof(cl_uint)*MIN(T, b->rows*width));
+            rt_buffer_fit(d, &d->batch_out, &d->batch_out_size,
+                          CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                          sizeof(color_t)*MIN(T, b->rows*width));
+
+            cl_int r = clEnqueueWriteBuffer(d->q, d->batch_in, CL_FALSE, 0,
+                                            world_size(w), w, 0, NULL, NULL);
+            CHECK_OCL(r, "clEnqueueWriteBuffer");
+
+            rt_tree_write(d);
+            rt_kernel_arg(d->acc, 0, sizeof(d->batch_in), &d->batch_in);
+            rt_kernel_arg(d->acc, 1, sizeof(d->nodes), &d->nodes);
+            rt_kernel_arg(d->acc, 2, sizeof(d->objects), &d->objects);
+            rt_kernel_arg(d->acc, 4, sizeof(W), &W);
+            rt_kernel_arg(d->acc, 5, sizeof(H), &H);
+            rt_kernel_arg(d->acc, 6, sizeof(N), &N);
+            rt_kernel_arg(d->acc, 9, sizeof(stride), &stride);
+        }
+    }
+
+    size_t n = 0, m = 1; double per = 0;
+    while(n < samples) {
+        const double left = ms - (rt_now_ms() - t0);
+        if(n > 0 && per*m > left) m = left > 0 ? left/per : 0;
+        m = MIN(m, samples - n);
+        if(m == 0) break;
+
+        double t;
+        if(rt_state.native) {
+            const double t1 = rt_now_ms();
+            native_accumulate(w, rt_state.tree.nodes, rt_state.tree.objects,
+                              sums, width, height, samples, n, n + m, stride);
+            t = rt_now_ms() - t1;
+        } else {
+            t = rt_budget_batch(bs, dms, width, n, n + m);
+        }
+
+        debug("rt_draw_budget: samples %zu-%zu in %.3f ms", n, n + m - 1, t);
+        per = t/m; n += m; m *= 2;
+    }
+
+    if(rt_state.native) {
+        native_resolve(sums, buf, width*height, n);
+        free(sums);
+    } else {
+        const cl_ulong n_ = n;
+        for(size_t i = 0; i < rt_state.devices_len; i++) {
+            struct rt_device* d = &rt_state.devices[i];
+            struct rt_band* b = &bs[i];
+            if(b->rows == 0) continue;
+
+            rt_kernel_arg(d->resolve, 1, sizeof(d->batch_out), &d->batch_out);
+            rt_kernel_arg(d->resolve, 2, sizeof(n_), &n_);
+
+            // a tile's averages are read back before the next tile's
+            // overwrite them, the queue being in order
+            const size_t T = rt_sums_tile(d);
+            for(size_t k = 0; k < rt_band_tiles(b, width, T); k++) {
+                size_t o[2], g[2]; rt_band_tile(b, width, T, k, o, g);
+                rt_kernel_arg(d->resolve, 0, sizeof(d->sums[k]), &d->sums[k]);
+                cl_int r = clEnqueueNDRangeKernel(
+                    d->q, d->resolve, 1, NULL, (size_t[]){ g[0]*g[1] },
+                    NULL, 0, NULL, NULL);
+                CHECK_OCL(r, "clEnqueueNDRangeKernel");
+
+                r = clEnqueueReadBuffer(d->q, d->batch_out, CL_FALSE, 0,
+                                        sizeof(color_t)*g[0]*g[1],
+                                        buf + o[0]*width + o[1],
+                                        0, NULL, NULL);
+                CHECK_OCL(r, "clEnqueueReadBuffer");
+            }
+            cl_int r = clFlush(d->q); CHECK_OCL(r, "clFlush");
+        }
+
+        for(size_t i = 0; i < rt_state.devices_len; i++) {
+            struct rt_device* d = &rt_state.devices[i];
+            if(bs[i].rows == 0) continue;
+
+            cl_int r = clFinish(d->q); CHECK_OCL(r, "clFinish");
+
+            // the rates are of the frames' full samples
+            rt_measure(d, bs[i].rows, dms[i]*samples/n);
+        }
+    }
+
+    info("rt_draw_budget: %zu/%zu samples in %.3f ms",
+         n, samples, rt_now_ms() - t0);
+    stopwatch_stop(rt_state.stopwatch_draw);
+    return n;
+}
+
+// the paths in flight of a wave, bounding its paths' memory
+#define RT_WAVE_PATHS (1 << 18)
+
+// a device's waves of pixels p0 up to p0 + n, the next starting at p
+struct rt_wave {
+    size_t p, p1, p0, n;
+    cl_uint live, q; cl_event read;
+};
+
+// the wave's paths still bouncing are intersected, shaded and compacted
+// into the other queue, whose length is read back
+static void rt_wave_bounce(struct rt_device* d, struct rt_wave* v)
+{
+    static const cl_uint zero = 0;
+    cl_int r = clEnqueueWriteBuffer(d->q, d->count, CL_FALSE, 0,
+                                    sizeof(zero), &zero, 0, NULL, NULL);
+    CHECK_OCL(r, "clEnqueueWriteBuffer");
+
+    cl_mem q = d->queues[v->q], next = d->queues[v->q ^ 1];
+    rt_kernel_arg(d->intersect, 4, sizeof(q), &q);
+    rt_kernel_arg(d->shade, 4, sizeof(q), &q);
+    rt_kernel_arg(d->shade, 5, sizeof(next), &next);
+
+    cl_kernel ks[] = { d->intersect, d->shade };
+    for(size_t i = 0; i < LENGTH(ks); i++) {
+        r = clEnqueueNDRangeKernel(d->q, ks[i], 1, NULL,
+                                   (size_t[]){ v->live }, NULL,
+                                   0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueNDRangeKernel");
+    }
+
+    r = clEnqueueReadBuffer(d->q, d->count, CL_FALSE, 0, sizeof(v->live),
+                            &v->live, 0, NULL, &v->read);
+    CHECK_OCL(r, "clEnqueueReadBuffer");
+    r = clFlush(d->q); CHECK_OCL(r, "clFlush");
+    v->q ^= 1;
+}
+
+// the wave's pixels are averaged and read back, and the next wave's paths
+// generated: returns whether there was one
+static int rt_wave_next(struct rt_device* d, struct rt_wave* v, size_t wave,
+                        size_t samples, color_t buf[])
+{
+    cl_int r;
+    if(v->n > 0) {
+        r = clEnqueueNDRangeKernel(d->q, d->accumulate, 1, NULL,
+                                   (size_t[]){ v->n }, NULL, 0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueNDRangeKernel");
+        r = clEnqueueReadBuffer(d->q, d->batch_out, CL_FALSE, 0,
+                                sizeof(color_t)*v->n, buf + v->p0,
+                                0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueReadBuffer");
+        v->n = 0;
+    }
+    if(v->p == v->p1) return 0;
+
+    v->p0 = v->p; v->n = MIN(wave, v->p1 - v->p); v->p += v->n;
+    v->live = v->n*samples; v->q = 0;
+
+    const cl_ulong P0 = v->p0;
+    rt_kernel_arg(d->generate, 6, sizeof(P0), &P0);
+    r = clEnqueueNDRangeKernel(d->q, d->generate, 1, NULL,
+                               (size_t[]){ v->live }, NULL, 0, NULL, NULL);
+    CHECK_OCL(r, "clEnqueueNDRangeKernel");
+    return 1;
+}
+
+// rt_draw with the paths traced a bounce at a time by separate kernels, in
+// waves of pixels: the paths that end are dropped from the queue of the
+// next bounce, so its work-items all have a path to trace
+void rt_draw_wavefront(const world_t* w, size_t width, size_t height,
+                       size_t samples, color_t buf[])
+{
+    if(rt_in_flight() > 0) {
+        failwith("rt_draw_wavefront with %zu frames in flight",
+                 rt_in_flight());
+    }
+
+    stopwatch_start(rt_state.stopwatch_draw);
+    const double t0 = rt_now_ms();
+    const cl_ulong W = width, H = height, N = samples;
+    const size_t wave = MAX(RT_WAVE_PATHS/samples, 1);
+    w = rt_tree(w);
+    if(!rt_state.native) rt_specialize(w);
+
+    size_t rays = 0;
+    if(rt_state.native) {
+        rays = native_draw_wavefront(w, rt_state.tree.nodes,
+                                     rt_state.tree.objects, width, height,
+                                     samples, wave, buf);
+    } else {
+        struct rt_wave vs[RT_DEVICES_MAX] = { 0 };
+        size_t us[RT_DEVICES_MAX + 1]; rt_split_units(height, us);
+        for(size_t i = 0; i < rt_state.devices_len; i++) {
+            struct rt_device* d = &rt_state.devices[i];
+            struct rt_wave* v = &vs[i];
+            v->p = us[i]*width; v->p1 = us[i + 1]*width;
+            if(v->p == v->p1) continue;
+
+            rt_kernel(d, &d->generate, "rt_wf_generate");
+            rt_kernel(d, &d->intersect, "rt_wf_intersect");
+            rt_kernel(d, &d->shade, "rt_wf_shade");
+            rt_kernel(d, &d->accumulate, "rt_wf_accumulate");
+
+            const size_t n = MIN(wave, v->p1 - v->p);
+            rt_buffer_fit(d, &d->batch_in, &d->batch_in_size,
+                          CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                          world_size(w));
+            rt_buffer_fit(d, &d->paths, &d->paths_size,
+                          CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+                          sizeof(path_t)*n*samples);
+            for(size_t j = 0; j < LENGTH(d->queues); j++) {
+                rt_buffer_fit(d, &d->queues[j], &d->queues_size[j],
+                              CL_MEM_READ_WRITE, sizeof(cl_uint)*n*samples);
+            }
+            rt_buffer_fit(d, &d->count, &d->count_size, CL_MEM_READ_WRITE,
+                          sizeof(cl_uint));
+            rt_buffer_fit(d, &d->batch_out, &d->batch_out_size,
+                          CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                          sizeof(color_t)*n);
+
+            cl_int r = clEnqueueWriteBuffer(d->q, d->batch_in, CL_FALSE, 0,
+                                            world_size(w), w, 0, NULL, NULL);
+            CHECK_OCL(r, "clEnqueueWriteBuffer");
+            rt_tree_write(d);
+
+            rt_kernel_arg(d->generate, 0, sizeof(d->batch_in), &d->batch_in);
+            rt_kernel_arg(d->generate, 1, sizeof(d->paths), &d->paths);
+            rt_kernel_arg(d->generate, 2, sizeof(d->queues[0]),
+                          &d->queues[0]);
+            rt_kernel_arg(d->generate, 3, sizeof(W), &W);
+            rt_kernel_arg(d->generate, 4, sizeof(H), &H);
+            rt_kernel_arg(d->generate, 5, sizeof(N), &N);
+
+            cl_kernel ks[] = { d->intersect, d->shade };
+            for(size_t j = 0; j < LENGTH(ks); j++) {
+                rt_kernel_arg(ks[j], 0, sizeof(d->batch_in), &d->batch_in);
+                rt_kernel_arg(ks[j], 1, sizeof(d->nodes), &d->nodes);
+                rt_kernel_arg(ks[j], 2, sizeof(d->objects), &d->objects);
+                rt_kernel_arg(ks[j], 3, sizeof(d->paths), &d->paths);
+            }
+            rt_kernel_arg(d->shade, 6, sizeof(d->count), &d->count);
+
+            rt_kernel_arg(d->accumulate, 0, sizeof(d->paths), &d->paths);
+            rt_kernel_arg(d->accumulate, 1, sizeof(d->batch_out),
+                          &d->batch_out);
+            rt_kernel_arg(d->accumulate, 2, sizeof(N), &N);
+        }
+
+        // the devices bounce their waves in lockstep, each waiting only for
+        // the length of its next queue
+        for(int busy = 1; busy;) {
+            busy = 0;
+            for(size_t i = 0; i < rt_state.devices_len; i++) {
+                struct rt_device* d = &rt_state.devices[i];
+                struct rt_wave* v = &vs[i];
+                if(v->live == 0 && !rt_wave_next(d, v, wave, samples, buf)) {
+                    continue;
+                }
+                rays += v->live; rt_wave_bounce(d, v); busy = 1;
+            }
+
+            for(size_t i = 0; i < rt_state.devices_len; i++) {
+                if(vs[i].read == NULL) continue;
+                cl_int r = clWaitForEvents(1, &vs[i].read);
+                CHECK_OCL(r, "clWaitForEvents");
+                rt_release_event(&vs[i].read);
+            }
+        }
+
+        for(size_t i = 0; i < rt_state.devices_len; i++) {
+            cl_int r = clFinish(rt_state.devices[i].q);
+            CHECK_OCL(r, "clFinish");
+        }
+    }
+
+    const double ms = rt_now_ms() - t0;
+    info("rt_draw_wavefront: %zu rays in %.3f ms: %.3f Mrays/s, "
+         "%.2f rays per path", rays, ms, rays/ms/1e3,
+         (double)rays/(width*height*samples));
+    stopwatch_stop(rt_state.stopwatch_draw);
+}
+
+// the samples of a pixel traced before its noise is first estimated, and
+// between the estimates that follow
+#define RT_ADAPTIVE_BATCH 8
+
+// a device's band of pixels up to p1, traced a tile of n pixels from p0 at a
+// time: the tile has had its samples up to n0, live of its pixels are still
+// sampled and queued in queues[q]
+struct rt_adaptive {
+    size_t p0, p1, n, n0;
+    cl_uint live, q; cl_event read;
+};
+
+// the pixels of the device's tiles of pixel_stats_t, which take as many
+// bytes as its tiles of pixels
+static size_t rt_stats_tile(const struct rt_device* d)
+{
+    return MAX(d->tile*sizeof(color_t)/sizeof(pixel_stats_t), 1);
+}
+
+// resolves the device's tile into buf once its pixels are done and moves on
+// to the next one, returns 0 when the band is done
+static int rt_adaptive_next(struct rt_device* d, struct rt_adaptive* a,
+                            size_t samples, color_t buf[])
+{
+    if(a->n > 0 && a->live > 0 && a->n0 < samples) return 1;
+
+    cl_int r;
+    if(a->n > 0) {
+        // the read completes before the next tile's batches, the queue being
+        // in order
+        rt_kernel_arg(d->resolve_adaptive, 0, sizeof(d->stats), &d->stats);
+        rt_kernel_arg(d->resolve_adaptive, 1, sizeof(d->batch_out),
+                      &d->batch_out);
+        r = clEnqueueNDRangeKernel(
+            d->q, d->resolve_adaptive, 1, NULL, (size_t[]){ a->n }, NULL,
+            0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueNDRangeKernel");
+
+        r = clEnqueueReadBuffer(d->q, d->batch_out, CL_FALSE, 0,
+                                sizeof(color_t)*a->n, buf + a->p0,
+                                0, NULL, NULL);
+        CHECK_OCL(r, "clEnqueueReadBuffer");
+        r = clFlush(d->q); CHECK_OCL(r, "clFlush");
+        a->p0 += a->n;
+    }
+
+    a->n = MIN(rt_stats_tile(d), a->p1 - a->p0);
+    if(a->n == 0) return 0;
+    a->n0 = 0; a->live = a->n; a->q = 0;
+
+    const cl_ulong P0 = a->p0;
+    rt_kernel_arg(d->adaptive, 10, sizeof(P0), &P0);
+    return 1;
+}
+
+// traces the next batch of the tile's live pixels' samples, whose pixels
+// still sampled are counted into a->live by a->read; returns the samples
+static size_t rt_adaptive_batch(struct rt_device* d, struct rt_adaptive* a,
+                                size_t samples)
+{
+    static const cl_uint zero = 0;
+    const cl_ulong A = a->n0, B = MIN(a->n0 + RT_ADAPTIVE_BATCH, samples);
+
+    cl_int r = clEnqueueWriteBuffer(d->q, d->count, CL_FALSE, 0,
+                                    sizeof(zero), &zero, 0, NULL, NULL);
+    CHECK_OCL(r, "clEnqueueWriteBuffer");
+
+    cl_mem q = d->queues[a->q], next = d->queues[a->q ^ 1];
+    rt_kernel_arg(d->adaptive, 4, sizeof(q), &q);
+    rt_kernel_arg(d->adaptive, 5, sizeof(next), &next);
+    rt_kernel_arg(d->adaptive, 11, sizeof(A), &A);
+    rt_kernel_arg(d->adaptive, 12, sizeof(B), &B);
+    r = clEnqueueNDRangeKernel(d->q, d->adaptive, 1, NULL,
+                               (size_t[]){ a->live }, NULL, 0, NULL, NULL);
+    CHECK_OCL(r, "clEnqueueNDRangeKernel");
+    const size_t traced = a->live*(B - A);
+
+    r = clEnqueueReadBuffer(d->q, d->count, CL_FALSE, 0, sizeof(a->live),
+                            &a->live, 0, NULL, &a->read);
+    CHECK_OCL(r, "clEnqueueReadBuffer");
+    r = clFlush(d->q); CHECK_OCL(r, "clFlush");
+
+    a->q ^= 1; a->n0 = B;
+    return traced;
+}
+
+// rt_draw sampling each pixel only until the standard error of its mean
+// luminance, estimated after each batch of its samples, is at most threshold
+// (in levels of 255): the pixels still sampled are compacted into a queue
+// after each batch; returns the samples traced, at most width*height*samples
+size_t rt_draw_adaptive(const world_t* w, size_t width, size_t height,
+                        size_t samples, float threshold, color_t buf[])
+{
+    if(rt_in_flight() > 0) {
+        failwith("rt_draw_adaptive with %zu frames in flight",
+                 rt_in_flight());
+    }
+
+    stopwatch_start(rt_state.stopwatch_draw);
+    const double t0 = rt_now_ms();
+    const cl_ulong W = width, H = height, N = samples;
+    const cl_ulong stride = rt_sample_stride(samples);
+    const cl_float T = threshold;
+    w = rt_tree(w);
+    if(!rt_state.native) rt_specialize(w);
+
+    size_t traced = 0;
+    if(rt_state.native) {
+        traced = native_draw_adaptive(w, rt_state.tree.nodes,
+                                      rt_state.tree.objects, width, height,
+                                      samples, stride, threshold,
+                                      RT_ADAPTIVE_BATCH, buf);
+    } else {
+        struct rt_adaptive as[RT_DEVICES_MAX] = { 0 };
+        size_t us[RT_DEVICES_MAX + 1]; rt_split_units(height, us);
+        for(size_t i = 0; i < rt_state.devices_len; i++) {
+            struct rt_device* d = &rt_state.devices[i];
+            struct rt_adaptive* a = &as[i];
+            a->p0 = us[i]*width; a->p1 = us[i + 1]*width;
+            const size_t n = MIN(rt_stats_tile(d), a->p1 - a->p0);
+            if(n == 0) continue;
+
+            rt_kernel(d, &d->adaptive, "rt_ray_trace_adaptive");
+            rt_kernel(d, &d->resolve_adaptive, "rt_resolve_adaptive");
+
+            rt_buffer_fit(d, &d->batch_in, &d->batch_in_size,
+                          CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY,
+                          world_size(w));
+            rt_buffer_fit(d, &d->stats, &d->stats_size,
+                          CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+                          sizeof(pixel_stats_t)*n);
+            for(size_t j = 0; j < LENGTH(d->queues); j++) {
+                rt_buffer_fit(d, &d->queues[j], &d->queues_size[j],
+                              CL_MEM_READ_WRITE, sizeof(cl_uint)*n);
+            }
+            rt_buffer_fit(d, &d->count, &d->count_size, CL_MEM_READ_WRITE,
+                          sizeof(cl_uint));
+            rt_buffer_fit(d, &d->batch_out, &d->batch_out_size,
+                          CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY,
+                          sizeof(color_t)*n);
+
+            cl_int r = clEnqueueWriteBuffer(d->q, d->batch_in, CL_FALSE, 0,
+                                            world_size(w), w, 0, NULL, NULL);
+            CHECK_OCL(r, "clEnqueueWriteBuffer");
+            rt_tree_write(d);
+
+            rt_kernel_arg(d->adaptive, 0, sizeof(d->batch_in), &d->batch_in);
+            rt_kernel_arg(d->adaptive, 1, sizeof(d->nodes), &d->nodes);
+            rt_kernel_arg(d->adaptive, 2, sizeof(d->objects), &d->objects);
+            rt_kernel_arg(d->adaptive, 3, sizeof(d->stats), &d->stats);
+            rt_kernel_arg(d->adaptive, 6, sizeof(d->count), &d->count);
+            rt_kernel_arg(d->adaptive, 7, sizeof(W), &W);
+            rt_kernel_arg(d->adaptive, 8, sizeof(H), &H);
+            rt_kernel_arg(d->adaptive, 9, sizeof(N), &N);
+            rt_kernel_arg(d->adaptive, 13, sizeof(stride), &stride);
+            rt_kernel_arg(d->adaptive, 14, sizeof(T), &T);
+        }
+
+        // the devices trace their tiles' batches in lockstep, each waiting
+        // only for the count of its pixels still sampled
+        for(int busy = 1; busy;) {
+            busy = 0;
+            for(size_t i = 0; i < rt_state.devices_len; i++) {
+                struct rt_device* d = &rt_state.devices[i];
+                struct rt_adaptive* a = &as[i];
+                if(a->p0 == a->p1 || !rt_adaptive_next(d, a, samples, buf)) {
+                    continue;
+                }
+                traced += rt_adaptive_batch(d, a, samples); busy = 1;
+            }
+
+            for(size_t i = 0; i < rt_state.devices_len; i++) {
+                if(as[i].read == NULL) continue;
+                cl_int r = clWaitForEvents(1, &as[i].read);
+                CHECK_OCL(r, "clWaitForEvents");
+                rt_release_event(&as[i].read);
+            }
+        }
+
+        for(size_t i = 0; i < rt_state.devices_len; i++) {
+            cl_int r = clFinish(rt_state.devices[i].q);
+            CHECK_OCL(r, "clFinish");
+        }
+    }
 
+    const size_t full = width*height*samples;
+    info("rt_draw_adaptive: %zu/%zu samples (%.1f%%), %.2f per pixel, "
+         "in %.3f ms", traced, full, 100.0*traced/full,
+         (double)traced/(width*height), rt_now_ms() - t0);
     stopwatch_stop(rt_state.stopwatch_draw);
+    return traced;
 }
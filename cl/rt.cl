@@ -1,5 +1,20 @@
 /* vim: set ft=c: */
 
+#ifdef RT_OBJECTS
+// the program is specialized to the scene (see rt_specialize): the count,
+// shapes and materials of the world's objects are constants, so the loops
+// over them unroll and their shapes' branches fold; with the spheres in the
+// hierarchy (see rt_tree) these are only the planes, the hierarchy's objects
+// are read from memory as without RT_OBJECTS
+#define OBJECTS_LEN(w) RT_OBJECTS
+#define OBJECT_SHAPE(w, i) rt_shapes[i]
+#define OBJECT_MATERIAL(w, i) rt_materials[i]
+#else
+#define OBJECTS_LEN(w) ((w)->objects_len)
+#define OBJECT_SHAPE(w, i) ((w)->objects[i].shape_type)
+#define OBJECT_MATERIAL(w, i) ((w)->objects[i].material)
+#endif
+
 vec_t line_coord(line_t l, float t)
 {
     return mad(t, l.b, l.p);
@@ -38,199 +53,493 @@ int solve_2nd_order(float b, float c, float t[])
     return 2;
 }
 
-inline int intersect_line_sphere(line_t* l, __constant sphere_t* s, float t[])
+inline int intersect_line_sphere(line_t* l, sphere_t s, float t[])
 {
-    const vec_t d = l->p - s->c;
+    const vec_t d = l->p - s.c;
     return solve_2nd_order(
         dot(l->b, d),
-        dot(d, d) - s->r*s->r,
+        dot(d, d) - s.r*s.r,
         t
     );
 }
 
-int intersect_line_plane(line_t* l, __constant plane_t* p, float t[])
+int intersect_line_plane(line_t* l, plane_t p, float t[])
 {
-    const float u = dot(p->p - l->p, p->n);
+    const float u = dot(p.p - l->p, p.n);
     if(is_zero(u)) return t[0] = 0, 1; // line is in the plane
-    const float v = dot(l->b, p->n);
+    const float v = dot(l->b, p.n);
     if(is_zero(v)) return 0; // line is parallel
     return t[0] = u / v, 1;
 }
 
-int intersect_line_object(line_t* l, __constant object_t* o, float t[])
+int intersect_line_object(line_t* l, __constant object_t* o,
+                          shape_type_t shape, float t[])
 {
-    switch(o->shape_type) {
+    switch(shape) {
     case SHAPE_TYPE_SPHERE:
-        return intersect_line_sphere(l, &o->shape.sphere, t);
+        return intersect_line_sphere(l, o->shape.sphere, t);
     case SHAPE_TYPE_PLANE:
-        return intersect_line_plane(l, &o->shape.plane, t);
+        return intersect_line_plane(l, o->shape.plane, t);
     }
     return -1;
 }
 
-int find_collision(line_t* l, __constant world_t* w, float* t, int exclude)
+/* the scene: the world's objects, which are tested one by one, followed by
+ * the spheres of a bounding volume hierarchy (see bvh_skip_node_t) kept in
+ * __global memory since they do not fit in __constant memory */
+typedef struct {
+    __constant world_t* w;
+    __global const bvh_skip_node_t* nodes;
+    __global const object_t* objects;
+} scene_t;
+
+inline object_t scene_object(scene_t s, int i)
+{
+    const int L = OBJECTS_LEN(s.w);
+    if(i < L) return s.w->objects[i];
+    return s.objects[i - L];
+}
+
+inline shape_type_t scene_shape(scene_t s, int i)
+{
+    return i < OBJECTS_LEN(s.w) ? OBJECT_SHAPE(s.w, i) : SHAPE_TYPE_SPHERE;
+}
+
+// whether the line meets the node's box between 0 and t_max, inv being the
+// inverse of the line's direction
+inline bool hit_box(const float p[3], const float inv[3],
+                    __global const bvh_skip_node_t* n, float t_max)
+{
+    float t0 = 0, t1 = t_max;
+    for(int k = 0; k < 3; k++) {
+        const float a = (n->lo[k] - p[k])*inv[k], b = (n->hi[k] - p[k])*inv[k];
+        t0 = max(t0, min(a, b)); t1 = min(t1, max(a, b));
+    }
+    return t0 <= t1;
+}
+
+// whether the nearest of the r intersections s ahead of the line, moved to
+// s[0], is nearer than t_min (none when negative)
+inline bool nearer(int r, float s[], float t_min)
+{
+    for(size_t j = 0; j < r; j++) {
+        if(s[0] < 0 || s[j] < s[0]) s[0] = s[j];
+    }
+    return r > 0 && s[0] >= 0 && (t_min < 0 || s[0] < t_min);
+}
+
+int find_collision(line_t* l, scene_t sc, float* t, int exclude)
 {
-    float t_min = -1; size_t n = w->objects_len;
+    float t_min = -1; int n = -1;
 
-    for(size_t i = 0; i < w->objects_len; i++) {
+    for(size_t i = 0; i < OBJECTS_LEN(sc.w); i++) {
         if(i == exclude) continue;
 
         float s[2];
-        int r = intersect_line_object(l, &w->objects[i], s);
+        int r = intersect_line_object(l, &sc.w->objects[i],
+                                      OBJECT_SHAPE(sc.w, i), s);
+        if(nearer(r, s, t_min)) { t_min = s[0]; n = i; }
+    }
 
-        for(size_t j = 0; j < r; j++) {
-            if(s[0] < 0 || s[j] < s[0]) s[0] = s[j];
+    // the nodes are visited in depth-first order without a stack: a subtree
+    // whose box the line misses, or meets beyond the nearest collision so
+    // far, is skipped
+    float p[3], inv[3];
+    vstore3(l->p, 0, p); vstore3(1.0f/l->b, 0, inv);
+    const int L = OBJECTS_LEN(sc.w);
+    for(uint i = 0, e = sc.nodes[0].skip; i < e;) {
+        __global const bvh_skip_node_t* node = &sc.nodes[i];
+        if(!hit_box(p, inv, node, t_min < 0 ? INFINITY : t_min)) {
+            i = node->skip; continue;
         }
 
-        if(r > 0 && s[0] >= 0 && (t_min < 0 || s[0] < t_min)) {
-            t_min = s[0]; n = i;
+        for(uint j = node->first; j < node->first + node->count; j++) {
+            if(L + j == exclude) continue;
+
+            float s[2];
+            int r = intersect_line_sphere(l, sc.objects[j].shape.sphere, s);
+            if(nearer(r, s, t_min)) { t_min = s[0]; n = L + j; }
         }
+        i++;
     }
 
-    if(n < w->objects_len) {
-        if(t != NULL) {
-            *t = t_min;
-        }
-        return n;
-    } else {
-        return -1;
+    if(n >= 0 && t != NULL) {
+        *t = t_min;
     }
+    return n;
 }
 
-vec_t disperse(vec_t n, seed_t seed)
+philox4_t draw(__constant world_t* w, uint frame, uint pixel, uint sample,
+               uint bounce)
 {
-    vec_t d, e;
-    if(dot(n, d = unit_vectors(rnd(&seed))) < 0) d *= -1;
-    if(dot(n, e = unit_vectors(rnd(&seed))) < 0) e *= -1;
-    return normalize(mix(d, e, uniform_float(seed)));
+    return philox_draw((uint)w->seed, frame, pixel, sample, bounce);
 }
 
-typedef struct {
-    material_t m;
-} ray_collision_t;
+vec_t disperse(vec_t n, philox4_t r)
+{
+    vec_t d, e;
+    if(dot(n, d = unit_vectors(r.v[2])) < 0) d *= -1;
+    if(dot(n, e = unit_vectors(r.v[3])) < 0) e *= -1;
+    return normalize(mix(d, e, uniform_float(r.v[3])));
+}
 
-inline ray_collision_t sky_collision(__constant sky_t* s, const line_t* l)
+inline material_t sky_collision(__constant sky_t* s, const line_t* l)
 {
     float f = max(1 - acos(dot(fast_normalize(s->sun), l->b))/M_PI_F, s->min);
-    return (ray_collision_t) {
-        .m = {
-            .light = color(f*s->color.r, f*s->color.g, f*s->color.b),
-            .color = black
-        }
+    return (material_t) {
+        .light = color(f*s->color.r, f*s->color.g, f*s->color.b),
+        .color = black
     };
 }
 
-vec_t object_normal(vec_t p, __constant object_t* o)
+vec_t object_normal(vec_t p, const object_t* o, shape_type_t shape)
 {
-    switch(o->shape_type) {
+    switch(shape) {
     case SHAPE_TYPE_SPHERE:
         return (p - o->shape.sphere.c)/o->shape.sphere.r;
     case SHAPE_TYPE_PLANE:
         return o->shape.plane.n;
     }
+    return vec(0, 0, 0);
 }
 
 // pre-conditions: l->p is in the surface of o->shape
-line_t reflect_line_object(line_t* l, __constant object_t* o)
+line_t reflect_line_object(line_t* l, const object_t* o, shape_type_t shape)
 {
-    const vec_t n = object_normal(l->p, o);
+    const vec_t n = object_normal(l->p, o, shape);
     return (line_t) { .p = l->p, .b = fma(2*dot(l->b, n), n, -l->b) };
 }
 
-#define RAY_TRACE_DEPTH 10
-
-color_t ray_trace_one_line(__constant world_t* w, const line_t* line, seed_t s)
+/* the material of the object o the line meets at t, the line becoming the
+ * one leaving the collision point: reflected, or dispersed when the bounce's
+ * random numbers say so */
+inline material_t scatter(scene_t s, line_t* l, int o, float t, uint frame,
+                          uint pixel, uint sample, uint bounce)
 {
-    ray_collision_t cs[RAY_TRACE_DEPTH];
-
-    line_t l = *line; int o = -1;
-    size_t n = 0; for(; n < RAY_TRACE_DEPTH; n++) {
-        float t;
-        o = find_collision(&l, w, &t, o);
-        if(o < 0) {
-            cs[n] = sky_collision(&w->sky, &l);
-            break;
-        } else {
-            cs[n] = (ray_collision_t){ .m = w->objects[o].material };
-        }
+    const object_t obj = scene_object(s, o);
+    const material_t m = o < OBJECTS_LEN(s.w) ? OBJECT_MATERIAL(s.w, o)
+                                              : obj.material;
 
-        // reorient the line to originate from the collision point
-        l.p = line_coord(l, t);
-        l.b = -l.b;
+    // reorient the line to originate from the collision point
+    l->p = line_coord(*l, t);
+    l->b = -l->b;
 
-        l = reflect_line_object(&l, &w->objects[o]);
+    const shape_type_t shape = scene_shape(s, o);
+    *l = reflect_line_object(l, &obj, shape);
 
-        if((rnd(&s) & w->objects[o].material.disperse) != 0) {
-            l.b = disperse(object_normal(l.p, &w->objects[o]), s);
-        }
+    const philox4_t r = draw(s.w, frame, pixel, sample, bounce);
+    if((rnd_bits(r) & m.disperse) != 0) {
+        l->b = disperse(object_normal(l->p, &obj, shape), r);
     }
+    return m;
+}
 
+// the color of a path that met the materials ms[0] up to ms[n], black for a
+// path still bouncing after RAY_TRACE_DEPTH collisions
+inline color_t path_color(const material_t ms[], uint n)
+{
     if(n == RAY_TRACE_DEPTH) { return black; }
 
     color_t c = black;
     for(int j = n; j >= 0; j--) {
-        c = color_mix(cs[j].m.color, c);
-        c = color_add(cs[j].m.light, c);
+        c = color_mix(ms[j].color, c);
+        c = color_add(ms[j].light, c);
     }
     return c;
 }
 
-/* pre-condigtion: exists k: Even, (N = get_global_size) == 1 + k^2 */
-__kernel void rt_ray_trace(__constant world_t* world, __global color_t out[])
+color_t ray_trace_one_line(scene_t s, uint frame,
+                           const line_t* line, uint pixel, uint sample)
 {
-    const long y = get_global_id(0), H = get_global_size(0);
-    const long x = get_global_id(1), W = get_global_size(1);
-    const size_t n = get_global_id(2), N = get_global_size(2);
+    material_t ms[RAY_TRACE_DEPTH];
 
-    seed_t s = world->seed;
-    s += 134775813*x;
-    s += 12345*y;
-    s += 25214903917*n;
+    line_t l = *line; int o = -1;
+    size_t n = 0; for(; n < RAY_TRACE_DEPTH; n++) {
+        float t;
+        o = find_collision(&l, s, &t, o);
+        if(o < 0) {
+            ms[n] = sky_collision(&s.w->sky, &l);
+            break;
+        }
+        ms[n] = scatter(s, &l, o, t, frame, pixel, sample, n);
+    }
 
-    const vec_t u = /* stage forward */ world->view.look_at - world->view.camera;
-    const vec_t v = /* stage left */ normalize(cross(world->view.up, u));
+    return path_color(ms, n);
+}
+
+// a pixel's point on the stage and the steps between its samples
+typedef struct {
+    vec_t p, b0, b1;
+    float k;
+} pixel_grid_t;
+
+// pre-condigtion: exists k: Even, N == 1 + k^2
+inline pixel_grid_t pixel_grid(__constant view_t* view, const long W,
+                               const long H, const ulong N,
+                               const long y, const long x)
+{
+    const vec_t u = /* stage forward */ view->look_at - view->camera;
+    const vec_t v = /* stage left */ normalize(cross(view->up, u));
     const vec_t w = /* stage up */ normalize(
-        world->view.allow_tilt_shift ? world->view.up : cross(u, v)
+        view->allow_tilt_shift ? view->up : cross(u, v)
     );
 
     const float a = (float)H/W;
-    const float h = -2 * length(u) * tan(world->view.fov/2) / sqrt(1 + a*a);
-    const vec_t b0 = h *     v / W;
-    const vec_t b1 = h * a * w / H;
-    vec_t p = world->view.look_at + (x - W/2)*b0 + (y - H/2)*b1;
+    const float h = -2 * length(u) * tan(view->fov/2) / sqrt(1 + a*a);
+    const vec_t b0 = h *     v / (float)W;
+    const vec_t b1 = h * a * w / (float)H;
+    return (pixel_grid_t) {
+        .p = view->look_at + (float)(x - W/2)*b0 + (float)(y - H/2)*b1,
+        .b0 = b0, .b1 = b1,
+        .k = sqrt((float)(N-1)),
+    };
+}
 
+// the line from the camera through the pixel's sample n of N
+inline line_t pixel_line(__constant view_t* view, const pixel_grid_t* g,
+                         const ulong N, const size_t n)
+{
+    vec_t q = g->p;
     if(N > 1) {
-        const float k = sqrt((float)(N-1));
-        int quo, rem = remquo(n, k, &quo);
-        p += ((quo - 2)*b0 + (rem - 2)*b1) / k;
+        int quo, rem = remquo(n, g->k, &quo);
+        q += ((float)(quo - 2)*g->b0 + (float)(rem - 2)*g->b1) / g->k;
     }
+    return line_from_two_points(view->camera, q);
+}
 
-    const line_t l = line_from_two_points(world->view.camera, p);
-    out[(y*W + x)*N + n] = ray_trace_one_line(world, &l, s);
+/* adds the samples i*stride % N, for i from n0 up to n1, of the pixel y, x of
+ * the frame seen from view to c: with stride 1 and i up to N these are the
+ * pixel's samples in order */
+inline void rt_sample_pixel(scene_t scene, __constant view_t* view,
+                            const uint frame, const long W, const long H,
+                            const ulong N, const long y, const long x,
+                            const ulong n0, const ulong n1,
+                            const ulong stride, uint c[3])
+{
+    const pixel_grid_t g = pixel_grid(view, W, H, N, y, x);
+    for(size_t i = n0; i < n1; i++) {
+        const size_t n = i*stride % N;
+        const line_t l = pixel_line(view, &g, N, n);
+        const color_t s = ray_trace_one_line(scene, frame, &l, y*W + x, n);
+        c[0] += s.r; c[1] += s.g; c[2] += s.b;
+    }
 }
 
-__kernel void rt_sample(__constant color_t in[], const ulong N,
-                        __global color_t out[])
+/* the pixel y, x of the frame seen from view, in the tile of cols columns at
+ * Y0, X0: its N samples are traced and averaged into the tile's out */
+inline void rt_trace_pixel(scene_t scene, __constant view_t* view,
+                           const uint frame, __global color_t out[],
+                           const long W, const long H, const ulong N,
+                           const long y, const long x,
+                           const long Y0, const long X0, const long cols)
 {
-    const long Y = get_global_id(0), H = get_global_size(0);
-    const long X = get_global_id(1), W = get_global_size(1);
+    uint c[3] = { 0 };
+    rt_sample_pixel(scene, view, frame, W, H, N, y, x, 0, N, 1, c);
+    out[(y - Y0)*cols + x - X0] = color(c[0]/N, c[1]/N, c[2]/N);
+}
 
-    color_t p = in[(Y*W + X)*N];
+/* the range is a tile of the frame's height rows and width columns starting
+ * at the range's offset, out holds only the tile: the rows are the range's
+ * first dimension */
+__kernel void rt_ray_trace(__constant world_t* world,
+                           __global const bvh_skip_node_t nodes[],
+                           __global const object_t objects[],
+                           __global color_t out[],
+                           const ulong width, const ulong height,
+                           const ulong N)
+{
+    const scene_t scene = { world, nodes, objects };
+    rt_trace_pixel(scene, &world->view, world->frame, out, width, height, N,
+                   get_global_id(0), get_global_id(1),
+                   get_global_offset(0), get_global_offset(1),
+                   get_global_size(1));
+}
 
-    uint3 c = 0; ulong M = 0; const long s = 0;
-    for(long i = -s; i <= s; i++) {
-        for(long j = -s; j <= s; j++) {
-            long x = X + i, y = Y + j;
-            if(x >= 0 && x < W && y >= 0 && y < H) {
-                const ulong k = 1 + 2*s - (abs(i) + abs(j));
-                for(size_t n = 0; n < N; n++) {
-                    const color_t s = in[(y*W + x)*N + n];
-                    M += k;
-                    c.s0 += k*s.r; c.s1 += k*s.g; c.s2 += k*s.b;
-                }
-            }
-        }
+// rt_ray_trace with the columns as the range's first dimension
+__kernel void rt_ray_trace_t(__constant world_t* world,
+                             __global const bvh_skip_node_t nodes[],
+                             __global const object_t objects[],
+                             __global color_t out[],
+                             const ulong width, const ulong height,
+                             const ulong N)
+{
+    const scene_t scene = { world, nodes, objects };
+    rt_trace_pixel(scene, &world->view, world->frame, out, width, height, N,
+                   get_global_id(1), get_global_id(0),
+                   get_global_offset(1), get_global_offset(0),
+                   get_global_size(0));
+}
+
+/* frames of the world seen from views[k], frame k being the world's frame
+ * plus k: the range's first dimension is the frame, then the rows and the
+ * columns, out holds the range's frames one after another */
+__kernel void rt_ray_trace_batch(__constant world_t* world,
+                                 __global const bvh_skip_node_t nodes[],
+                                 __global const object_t objects[],
+                                 __constant view_t views[],
+                                 __global color_t out[],
+                                 const ulong width, const ulong height,
+                                 const ulong N)
+{
+    const long k = get_global_id(0), K0 = get_global_offset(0);
+    const long W = width, H = height;
+    const scene_t scene = { world, nodes, objects };
+    rt_trace_pixel(scene, &views[k], world->frame + k, out + (k - K0)*W*H,
+                   W, H, N, get_global_id(1), get_global_id(2), 0, 0, W);
+}
+
+/* the samples n0 up to n1 of the N of the range's pixels, in the order of
+ * stride (coprime with N, so that the first samples are spread over the
+ * pixel): sums holds the range's running sums, set by the first samples */
+__kernel void rt_ray_trace_acc(__constant world_t* world,
+                               __global const bvh_skip_node_t nodes[],
+                               __global const object_t objects[],
+                               __global uint sums[],
+                               const ulong width, const ulong height,
+                               const ulong N, const ulong n0, const ulong n1,
+                               const ulong stride)
+{
+    const long y = get_global_id(0), Y0 = get_global_offset(0);
+    const long x = get_global_id(1), X0 = get_global_offset(1);
+    const long cols = get_global_size(1);
+
+    const scene_t scene = { world, nodes, objects };
+    uint c[3] = { 0 };
+    rt_sample_pixel(scene, &world->view, world->frame, width, height, N,
+                    y, x, n0, n1, stride, c);
+
+    __global uint* s = &sums[3*((y - Y0)*cols + x - X0)];
+    for(int j = 0; j < 3; j++) s[j] = n0 == 0 ? c[j] : s[j] + c[j];
+}
+
+// the pixels' averages of their n samples' sums
+__kernel void rt_resolve(__global const uint sums[], __global color_t out[],
+                         const ulong n)
+{
+    const size_t i = get_global_id(0);
+    out[i] = color(sums[3*i]/n, sums[3*i + 1]/n, sums[3*i + 2]/n);
+}
+
+/* wavefront tracing, see rt_draw_wavefront: path i of a wave is the sample
+ * i % N of the pixel p0 + i/N, its paths are traced a bounce at a time by
+ * rt_wf_intersect and rt_wf_shade over the queue of the paths still
+ * bouncing, which rt_wf_shade compacts into the next bounce's queue, and
+ * rt_wf_accumulate averages each pixel's paths */
+__kernel void rt_wf_generate(__constant world_t* world, __global path_t paths[],
+                             __global uint queue[],
+                             const ulong width, const ulong height,
+                             const ulong N, const ulong p0)
+{
+    const size_t i = get_global_id(0);
+    const long p = p0 + i/N, y = p/width, x = p%width;
+
+    const pixel_grid_t g = pixel_grid(&world->view, width, height, N, y, x);
+    __global path_t* q = &paths[i];
+    q->l = pixel_line(&world->view, &g, N, i%N);
+    q->o = -1; q->pixel = p; q->sample = i%N; q->n = 0;
+    queue[i] = i;
+}
+
+// the queued paths' next collisions
+__kernel void rt_wf_intersect(__constant world_t* world,
+                              __global const bvh_skip_node_t nodes[],
+                              __global const object_t objects[],
+                              __global path_t paths[],
+                              __global const uint queue[])
+{
+    const scene_t scene = { world, nodes, objects };
+    __global path_t* p = &paths[queue[get_global_id(0)]];
+
+    line_t l = p->l; float t;
+    p->o = find_collision(&l, scene, &t, p->o);
+    p->t = t;
+}
+
+// the queued paths' collisions, the paths bouncing on appended to next
+__kernel void rt_wf_shade(__constant world_t* world,
+                          __global const bvh_skip_node_t nodes[],
+                          __global const object_t objects[],
+                          __global path_t paths[],
+                          __global const uint queue[], __global uint next[],
+                          volatile __global uint* count)
+{
+    const scene_t scene = { world, nodes, objects };
+    const uint i = queue[get_global_id(0)];
+    __global path_t* p = &paths[i];
+
+    line_t l = p->l;
+    if(p->o < 0) {
+        p->ms[p->n] = sky_collision(&world->sky, &l);
+        return;
     }
 
-    out[Y*W + X] = color(c.s0/M, c.s1/M, c.s2/M);
+    p->ms[p->n] = scatter(scene, &l, p->o, p->t, world->frame,
+                          p->pixel, p->sample, p->n);
+    p->l = l;
+    if(++p->n < RAY_TRACE_DEPTH) next[atomic_inc(count)] = i;
+}
+
+// the average of the wave's pixels' N paths
+__kernel void rt_wf_accumulate(__global const path_t paths[],
+                               __global color_t out[], const ulong N)
+{
+    const size_t i = get_global_id(0);
+
+    uint c[3] = { 0 };
+    for(size_t j = 0; j < N; j++) {
+        __global const path_t* p = &paths[i*N + j];
+        const color_t s = path_color(p->ms, p->n);
+        c[0] += s.r; c[1] += s.g; c[2] += s.b;
+    }
+    out[i] = color(c[0]/N, c[1]/N, c[2]/N);
+}
+
+/* the samples i*stride % N, for i from n0 up to n1, of the queued pixels of
+ * the frame, stats holding the pixels from p0 on: the pixels with samples
+ * left whose mean's standard error is still above threshold are appended to
+ * next; the first samples are of every pixel from p0 on, without a queue */
+__kernel void rt_ray_trace_adaptive(__constant world_t* world,
+                                    __global const bvh_skip_node_t nodes[],
+                                    __global const object_t objects[],
+                                    __global pixel_stats_t stats[],
+                                    __global const uint queue[],
+                                    __global uint next[],
+                                    volatile __global uint* count,
+                                    const ulong width, const ulong height,
+                                    const ulong N, const ulong p0,
+                                    const ulong n0, const ulong n1,
+                                    const ulong stride, const float threshold)
+{
+    const scene_t scene = { world, nodes, objects };
+    const uint i = n0 == 0 ? p0 + get_global_id(0) : queue[get_global_id(0)];
+    const long y = i/width, x = i%width;
+
+    pixel_stats_t s = n0 == 0 ? (pixel_stats_t){ 0 } : stats[i - p0];
+    const pixel_grid_t g = pixel_grid(&world->view, width, height, N, y, x);
+    for(size_t k = n0; k < n1; k++) {
+        const size_t n = k*stride % N;
+        const line_t l = pixel_line(&world->view, &g, N, n);
+        const color_t c = ray_trace_one_line(scene, world->frame, &l, i, n);
+        s.sums[0] += c.r; s.sums[1] += c.g; s.sums[2] += c.b;
+
+        const float v = 0.2126f*c.r + 0.7152f*c.g + 0.0722f*c.b;
+        const float d = v - s.mean;
+        s.mean += d/(k + 1); s.m2 += d*(v - s.mean);
+    }
+    s.n = n1;
+    stats[i - p0] = s;
+
+    if(n1 < N && (n1 < 2 || sqrt(s.m2/((n1 - 1)*n1)) > threshold)) {
+        next[atomic_inc(count)] = i;
+    }
+}
+
+// the pixels' averages of their samples
+__kernel void rt_resolve_adaptive(__global const pixel_stats_t stats[],
+                                  __global color_t out[])
+{
+    const size_t i = get_global_id(0);
+    const uint n = stats[i].n;
+    out[i] = color(stats[i].sums[0]/n, stats[i].sums[1]/n,
+                   stats[i].sums[2]/n);
 }
@@ -48,6 +48,34 @@ typedef struct {
     material_t material;
 } object_t;
 
+// a node of a bounding volume hierarchy flattened in depth-first order: an
+// inner node's children follow it and skip is the node after its subtree, a
+// leaf's count objects start at first
+typedef struct {
+    float lo[3], hi[3];
+    unsigned int skip, first, count;
+} bvh_skip_node_t;
+
+#define RAY_TRACE_DEPTH 10
+
+// a path of the wavefront kernels: the line it goes on from, the object it
+// leaves and, once intersected, the object it meets at t (-1 for the sky),
+// ms being the materials of its n collisions so far
+typedef struct {
+    line_t l;
+    float t;
+    int o;
+    unsigned int pixel, sample, n;
+    material_t ms[RAY_TRACE_DEPTH];
+} path_t;
+
+// a pixel of rt_draw_adaptive: the sums of its n samples and the running
+// mean and squared deviations (Welford's) of their luminance
+typedef struct {
+    unsigned int sums[3], n;
+    float mean, m2;
+} pixel_stats_t;
+
 typedef struct {
     vec_t camera;
     vec_t look_at;
@@ -63,7 +91,10 @@ typedef struct {
 } sky_t;
 
 typedef struct {
+    // key of the frame's random numbers, see philox.h
     seed_t seed;
+    unsigned int frame;
+
     view_t view;
     sky_t sky;
     size_t objects_len;
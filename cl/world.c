@@ -1,18 +1,41 @@
 #include <math.h>
 
+// the camera circles the scene twice over the duration, the only part of the
+// world that changes between frames
+view_t create_view(float t, float duration, float fps)
+{
+    float angle = 2*2*M_PI/(duration*fps);
+    return (view_t) {
+        .camera = vec(10 - 20*cos(angle*t), 20*sin(angle*t), 10),
+        .up = vec(0, 0, 1),
+        .look_at = vec(10, 0, 5),
+        .fov = M_PI/2,
+    };
+}
+
+// uniform in [0, 1), the same sequence for every frame
+static float scatter(uint64_t* s)
+{
+    *s = *s*6364136223846793005ULL + 1442695040888963407ULL;
+    return (*s >> 40)/(float)(1 << 24);
+}
+
 world_t* create_world(float t, float duration, float fps)
 {
-    world_t* world = calloc(1, world_size_with_objects(5));
-    world->objects_len = 5;
+    // RT_SPHERES=n scatters n small spheres over the scene, filling the same
+    // share of its volume whatever n is, e.g. for benchmarking
+    const char* e = getenv("RT_SPHERES");
+    const size_t n = e != NULL ? strtoul(e, NULL, 0) : 0;
 
-    world->seed = xorshift128plus_i();
+    world_t* world = calloc(1, world_size_with_objects(5 + n));
+    CHECK_IF(world == NULL, "calloc");
+    world->objects_len = 5 + n;
 
-    float angle = 2*2*M_PI/(duration*fps);
-    world->view.camera = vec(10 - 20*cos(angle*t), 20*sin(angle*t), 10);
+    e = getenv("RT_SEED");
+    world->seed = e != NULL ? strtoul(e, NULL, 0) : 0;
+    world->frame = t;
 
-    world->view.up = vec(0, 0, 1);
-    world->view.look_at = vec(10, 0, 5);
-    world->view.fov = M_PI/2;
+    world->view = create_view(t, duration, fps);
 
     world->sky.sun = vec(1, 1, 1);
     world->sky.min = 0.1;
@@ -73,5 +96,22 @@ world_t* create_world(float t, float duration, float fps)
         },
     };
 
+    const color_t cs[] = { red, green, blue, violet, white };
+    uint64_t s = 1; const float r = 4/cbrt(MAX(n, 1));
+    for(size_t i = 0; i < n; i++) {
+        const vec_t c = vec(-10 + 40*scatter(&s), -20 + 40*scatter(&s),
+                            r + 10*scatter(&s));
+        world->objects[5 + i] = (object_t) {
+            .unique.seed = xorshift128plus_i(),
+            .shape_type = SHAPE_TYPE_SPHERE,
+            .shape.sphere = { .c = c, .r = r },
+            .material = {
+                .light = black,
+                .color = cs[i % LENGTH(cs)],
+                .disperse = i % 2 ? PROB_ALWAYS : PROB_NEVER,
+            },
+        };
+    }
+
     return world;
 }
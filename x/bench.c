@@ -0,0 +1,65 @@
+#include <r.h>
+#include "sample.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// microbenchmark of the batched sampling against the C library: ns per
+// direction for batches of n, over the instruction sets of the cpu
+
+#define BENCH_LINES 4096
+
+typedef void (*disperse_t)(size_t n, float factor, const vec_t v[],
+                           const philox4_t r[], vec_t out[]);
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    int r = clock_gettime(CLOCK_MONOTONIC, &ts);
+    CHECK(r, "clock_gettime");
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static vec_t v[BENCH_LINES], out[BENCH_LINES];
+static philox4_t r[BENCH_LINES];
+
+static double bench(disperse_t f, size_t n, size_t rounds)
+{
+    const double t0 = now_ns();
+    for(size_t k = 0; k < rounds; k++) {
+        for(size_t i = 0; i < BENCH_LINES; i += n) {
+            f(n, 0.3, &v[i], &r[i], &out[i]);
+        }
+    }
+    return (now_ns() - t0) / (rounds * BENCH_LINES);
+}
+
+int main(int argc, char** argv)
+{
+    sample_tests();
+
+    for(size_t i = 0; i < BENCH_LINES; i++) {
+        r[i] = philox4x32((philox4_t){ { i } }, (philox2_t){ { 0, 1 } });
+        v[i] = normalize(vec(1, (int32_t)r[i].v[0]/2e9f, (int32_t)r[i].v[1]/2e9f));
+    }
+
+    const size_t rounds = argc > 1 ? atoi(argv[1]) : 1000;
+    const size_t ns[] = { 1, 4, 16, 256 };
+
+    printf("%8s %6s %8s\n", "simd", "batch", "ns/line");
+    for(size_t j = 0; j < LENGTH(ns); j++) {
+        printf("%8s %6zu %8.2f\n", "libm", ns[j],
+               bench(sample_disperse_libm, ns[j], rounds));
+    }
+
+    for(enum simd s = SIMD_SCALAR; s <= simd_detect(); s++) {
+        sample_init(s);
+        for(size_t j = 0; j < LENGTH(ns); j++) {
+            printf("%8s %6zu %8.2f\n", simd_name(s), ns[j],
+                   bench(sample_disperse, ns[j], rounds));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <r.h>
+#include "bvh.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define BVH_BINS 16
+
+struct builder {
+    const float (*lo)[3], (*hi)[3];
+    float (*c)[3];
+    size_t width, max_leaf;
+    struct bvh* b;
+    size_t slots_cap;
+};
+
+typedef struct {
+    float lo[3], hi[3];
+} box_t;
+
+static box_t box_empty(void)
+{
+    return (box_t) {
+        .lo = { INFINITY, INFINITY, INFINITY },
+        .hi = { -INFINITY, -INFINITY, -INFINITY },
+    };
+}
+
+inline static void box_grow(box_t* b, const float lo[3], const float hi[3])
+{
+    for(size_t k = 0; k < 3; k++) {
+        b->lo[k] = MIN(b->lo[k], lo[k]); b->hi[k] = MAX(b->hi[k], hi[k]);
+    }
+}
+
+inline static float box_area(const box_t* b)
+{
+    const float x = b->hi[0] - b->lo[0], y = b->hi[1] - b->lo[1],
+                z = b->hi[2] - b->lo[2];
+    return x < 0 ? 0 : 2*(x*y + y*z + z*x);
+}
+
+// the cost of a leaf is the number of width-wide intersection kernels it takes
+inline static float blocks(const struct builder* B, size_t n)
+{
+    return (n + B->width - 1) / B->width;
+}
+
+static void make_leaf(struct builder* B, bvh_node_t* node,
+                      const uint32_t* idx, size_t n)
+{
+    struct bvh* b = B->b;
+    const size_t N = blocks(B, n) * B->width;
+
+    if(b->slots_len + N > B->slots_cap) {
+        B->slots_cap = MAX(2*B->slots_cap, b->slots_len + N);
+        b->slots = realloc(b->slots, sizeof(uint32_t)*B->slots_cap);
+        CHECK_IF(b->slots == NULL, "realloc");
+    }
+
+    node->first = b->slots_len; node->count = N;
+    for(size_t i = 0; i < N; i++) {
+        b->slots[b->slots_len++] = i < n ? idx[i] : BVH_EMPTY_SLOT;
+    }
+    b->leaves += 1;
+}
+
+static int bin_of(const box_t* cb, size_t axis, const float c[3])
+{
+    const float e = cb->hi[axis] - cb->lo[axis];
+    const int k = (int)(BVH_BINS * (c[axis] - cb->lo[axis]) / e);
+    return MIN(MAX(k, 0), BVH_BINS - 1);
+}
+
+static void build(struct builder* B, size_t node, uint32_t* idx, size_t n,
+                  size_t depth)
+{
+    struct bvh* b = B->b;
+    b->depth = MAX(b->depth, depth);
+
+    box_t bb = box_empty(), cb = box_empty();
+    for(size_t i = 0; i < n; i++) {
+        box_grow(&bb, B->lo[idx[i]], B->hi[idx[i]]);
+        box_grow(&cb, B->c[idx[i]], B->c[idx[i]]);
+    }
+
+    bvh_node_t* nd = &b->nodes[node];
+    for(size_t k = 0; k < 3; k++) { nd->lo[k] = bb.lo[k]; nd->hi[k] = bb.hi[k]; }
+
+    if(n <= 1) { make_leaf(B, nd, idx, n); return; }
+
+    // traversing a node is assumed to cost as much as one leaf kernel
+    const float A = box_area(&bb);
+    float best = INFINITY; size_t best_axis = 0; int best_split = 0;
+    for(size_t axis = 0; axis < 3; axis++) {
+        if(cb.hi[axis] - cb.lo[axis] <= 0) continue;
+
+        size_t count[BVH_BINS] = { 0 }; box_t bins[BVH_BINS];
+        for(size_t k = 0; k < BVH_BINS; k++) bins[k] = box_empty();
+        for(size_t i = 0; i < n; i++) {
+            const int k = bin_of(&cb, axis, B->c[idx[i]]);
+            count[k] += 1; box_grow(&bins[k], B->lo[idx[i]], B->hi[idx[i]]);
+        }
+
+        float right[BVH_BINS]; size_t nr = 0; box_t r = box_empty();
+        for(int k = BVH_BINS - 1; k > 0; k--) {
+            nr += count[k]; box_grow(&r, bins[k].lo, bins[k].hi);
+            right[k] = box_area(&r) * blocks(B, nr);
+        }
+
+        size_t nl = 0; box_t l = box_empty();
+        for(int k = 1; k < BVH_BINS; k++) {
+            nl += count[k-1]; box_grow(&l, bins[k-1].lo, bins[k-1].hi);
+            if(nl == 0 || nl == n) continue;
+            const float c = 1 + (box_area(&l) * blocks(B, nl) + right[k]) / A;
+            if(c < best) { best = c; best_axis = axis; best_split = k; }
+        }
+    }
+
+    if(n <= B->max_leaf && best >= blocks(B, n)) {
+        make_leaf(B, nd, idx, n); return;
+    }
+
+    size_t m = 0;
+    if(best < INFINITY) {
+        for(size_t i = 0; i < n; i++) {
+            if(bin_of(&cb, best_axis, B->c[idx[i]]) < best_split) {
+                const uint32_t t = idx[i]; idx[i] = idx[m]; idx[m++] = t;
+            }
+        }
+    } else {
+        m = n / 2; // coincident centroids
+    }
+
+    const size_t left = b->nodes_len; b->nodes_len += 2;
+    nd->first = left; nd->count = 0;
+
+    build(B, left, idx, m, depth + 1);
+    build(B, left + 1, idx + m, n - m, depth + 1);
+}
+
+struct bvh* bvh_build(const float (*lo)[3], const float (*hi)[3], size_t n,
+                      size_t width)
+{
+    struct bvh* b = calloc(sizeof(*b), 1);
+    CHECK_IF(b == NULL, "calloc");
+
+    struct builder B = {
+        .lo = lo, .hi = hi, .b = b,
+        .width = width, .max_leaf = MAX(width, 4),
+    };
+
+    // a binary tree with at most one leaf per box
+    b->nodes = calloc(sizeof(bvh_node_t), MAX(2*n, 1));
+    B.c = calloc(sizeof(*B.c), MAX(n, 1));
+    uint32_t* idx = calloc(sizeof(uint32_t), MAX(n, 1));
+    CHECK_IF(!b->nodes || !B.c || !idx, "calloc");
+
+    for(size_t i = 0; i < n; i++) {
+        idx[i] = i;
+        for(size_t k = 0; k < 3; k++) B.c[i][k] = (lo[i][k] + hi[i][k])/2;
+    }
+
+    b->nodes_len = 1;
+    build(&B, 0, idx, n, 1);
+
+    free(idx); free(B.c);
+    return b;
+}
+
+void bvh_free(struct bvh* b)
+{
+    free(b->nodes); free(b->slots); free(b);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// inner nodes: first is the index of the left child, the right child follows
+// it and count is 0; leaves: count slots starting at first
+typedef struct {
+    float lo[3], hi[3];
+    uint32_t first, count;
+} bvh_node_t;
+
+#define BVH_EMPTY_SLOT UINT32_MAX
+
+struct bvh {
+    bvh_node_t* nodes;
+    size_t nodes_len, leaves, depth;
+
+    // slots[i] is the index of the box in slot i or BVH_EMPTY_SLOT, every
+    // leaf is padded to a multiple of the width it was built for
+    uint32_t* slots;
+    size_t slots_len;
+};
+
+// binned SAH build over the boxes [lo[i], hi[i]] with leaves sized for
+// intersecting width boxes at a time
+struct bvh* bvh_build(const float (*lo)[3], const float (*hi)[3], size_t n,
+                      size_t width);
+void bvh_free(struct bvh* b);
@@ -1,12 +1,18 @@
+#include <math.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <xcb/xcb.h>
+#include <xcb/shm.h>
 #include <xcb/xcb_keysyms.h>
 #include <X11/keysym.h>
 
 #include <r.h>
 #include "rt.h"
+#include "resample.h"
 
 static xcb_screen_t* fetch_screen(xcb_connection_t* con, int screen)
 {
@@ -30,6 +36,37 @@ struct {
     int16_t x, y;
     uint16_t w, h;
 
+    // the image is refined in the back buffer while the front one is shown,
+    // busy buffers are still being read by the server
+    struct image {
+        color_t* px;
+        xcb_shm_seg_t seg;
+        int busy;
+    } images[2];
+    size_t front;
+    size_t samples, max_samples;
+
+    // dynamic resolution: passes are traced at scale times the window's size
+    // into low and upscaled, the scale is picked from the measured cost per
+    // traced pixel to meet the frame time target and then doubled pass by
+    // pass until the full size is reached
+    double target_ms, ms_per_px;
+    float scale;
+    color_t* low;
+
+    // MIT-SHM completion events, 0 when falling back to put_image
+    uint8_t shm_completion;
+
+    // the event loop hands work to the render thread under lock: every
+    // geometry change bumps the generation and cancels the pass in flight,
+    // so a burst of events results in a single resize
+    pthread_t renderer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    unsigned long generation;
+    uint16_t req_w, req_h;
+    int expose, quit, cancel;
+
     xcb_connection_t* con;
     xcb_window_t wi;
     xcb_gcontext_t gc;
@@ -71,6 +108,11 @@ void x11_init(void)
         failwith("xcb_create_window_checked failed: %u", err->error_code);
     }
 
+    // the first pass is at the created size: without a window manager the
+    // mapping is followed only by MapNotify and Expose, no ConfigureNotify
+    state.req_w = state.w; state.req_h = state.h;
+    state.generation = 1;
+
     // gc
     state.gc = xcb_generate_id(state.con);
     c = xcb_create_gc_checked(
@@ -80,6 +122,15 @@ void x11_init(void)
         failwith("xcb_create_gc_checked failed: %u", err->error_code);
     }
 
+    // shared memory images
+    const xcb_query_extension_reply_t* ext =
+        xcb_get_extension_data(state.con, &xcb_shm_id);
+    const char* e = getenv("RT_SHM");
+    if(ext != NULL && ext->present && (e == NULL || atoi(e) != 0)) {
+        state.shm_completion = ext->first_event + XCB_SHM_COMPLETION;
+    }
+    info("presenting using %s", state.shm_completion ? "MIT-SHM" : "put_image");
+
     // syms
     state.syms = xcb_key_symbols_alloc(state.con);
 
@@ -90,35 +141,214 @@ void x11_init(void)
     }
 }
 
+void flush(void)
+{
+    int r = xcb_flush(state.con);
+    if(r <= 0) { failwith("xcb_flush(...) == %d", r); }
+}
+
+static void image_free(struct image* i)
+{
+    if(i->px == NULL) return;
+
+    if(i->seg != 0) {
+        xcb_shm_detach(state.con, i->seg);
+        int r = shmdt(i->px); CHECK(r, "shmdt");
+    } else {
+        free(i->px);
+    }
+    *i = (struct image){ 0 };
+}
+
+// attach a shared memory segment or allocate a plain buffer when the server
+// can't use it (e.g. when it is remote)
+static void image_mk(struct image* i, size_t n)
+{
+    const size_t size = sizeof(color_t) * MAX(n, 1);
+
+    if(state.shm_completion) {
+        int id = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        CHECK(id, "shmget");
+        i->px = shmat(id, NULL, 0);
+        CHECK_IF(i->px == (void*)-1, "shmat");
+
+        i->seg = xcb_generate_id(state.con);
+        xcb_void_cookie_t c = xcb_shm_attach_checked(state.con, i->seg, id, 0);
+        xcb_generic_error_t* err = xcb_request_check(state.con, c);
+
+        // the segment goes away when both sides have detached
+        int r = shmctl(id, IPC_RMID, NULL); CHECK(r, "shmctl");
+
+        if(!err) return;
+
+        info("xcb_shm_attach_checked failed: %u, falling back to put_image",
+             err->error_code);
+        free(err);
+        r = shmdt(i->px); CHECK(r, "shmdt");
+        state.shm_completion = 0;
+    }
+
+    i->seg = 0;
+    i->px = calloc(sizeof(color_t), MAX(n, 1));
+    CHECK_IF(i->px == NULL, "calloc");
+}
+
+#define SCALE_MIN (1.0f/8)
+
+// the largest scale a pass is estimated to be traced at within the target
+static float fitting_scale(void)
+{
+    if(state.target_ms <= 0) return 1;
+    if(state.ms_per_px <= 0) return 2*SCALE_MIN;
+
+    const float s = sqrtf(state.target_ms/(state.ms_per_px*state.w*state.h));
+    return MIN(MAX(s, SCALE_MIN), 1);
+}
+
+inline static size_t scaled(uint16_t n)
+{
+    return MAX((size_t)(n*state.scale + 0.5f), 1);
+}
+
 void x11_deinit(void)
 {
+    for(size_t i = 0; i < LENGTH(state.images); i++) {
+        image_free(&state.images[i]);
+    }
+    free(state.low);
     xcb_key_symbols_free(state.syms);
     xcb_disconnect(state.con);
 }
 
-void render(void)
+static void resize(uint16_t w, uint16_t h)
 {
-    uint32_t buf[state.w * state.h];
-    rt_draw((color_t*)buf, state.h, state.w);
+    for(size_t i = 0; i < LENGTH(state.images); i++) {
+        image_free(&state.images[i]);
+        image_mk(&state.images[i], w*h);
+    }
+    state.w = w; state.h = h;
 
-    xcb_void_cookie_t c = xcb_put_image_checked(
-        state.con, XCB_IMAGE_FORMAT_Z_PIXMAP,
-        state.wi, state.gc,
-        state.w, state.h,
-        /* x */ 0, /* y */ 0,
-        0, state.sc->root_depth,
-        sizeof(buf), (uint8_t*)buf);
-    xcb_generic_error_t* err = xcb_request_check(state.con, c);
-    if(err) {
-        failwith("xcb_put_image_checked failed: %u", err->error_code);
+    // large enough for any scale below 1
+    free(state.low);
+    state.low = calloc(sizeof(color_t), MAX(w*h, 1));
+    CHECK_IF(state.low == NULL, "calloc");
+
+    state.scale = fitting_scale();
+    debug("scale: %.3f", state.scale);
+
+    rt_reset(); state.samples = 0;
+}
+
+// the pixels are BGRA, which is what a 24 or 32 bit deep little-endian
+// server expects, so neither path converts them
+void present(void)
+{
+    struct image* i = &state.images[state.front];
+
+    if(i->seg != 0) {
+        xcb_shm_put_image(
+            state.con, state.wi, state.gc,
+            state.w, state.h,
+            /* src */ 0, 0, state.w, state.h,
+            /* dst */ 0, 0,
+            state.sc->root_depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+            /* send_event */ 1, i->seg, 0);
+        i->busy = 1;
+    } else {
+        xcb_put_image(
+            state.con, XCB_IMAGE_FORMAT_Z_PIXMAP,
+            state.wi, state.gc,
+            state.w, state.h,
+            /* x */ 0, /* y */ 0,
+            0, state.sc->root_depth,
+            sizeof(color_t) * state.w * state.h, (uint8_t*)i->px);
     }
+
+    flush();
 }
 
+static int refining(void)
+{
+    return state.images[0].px != NULL
+        && (state.scale < 1 || state.samples < state.max_samples)
+        && !state.images[1 - state.front].busy;
+}
 
-void flush(void)
+// the render thread owns the images and their geometry, it adds one sample
+// per pixel into the back buffer at a time and shows it: the first pass is
+// shown immediately and later ones refine it, first in resolution and then
+// in samples
+static void* render_main(void* opaque)
 {
-    int r = xcb_flush(state.con);
-    if(r <= 0) { failwith("xcb_flush(...) == %d", r); }
+    unsigned long g = 0;
+
+    pthread_mutex_lock(&state.lock);
+    while(!state.quit) {
+        if(state.generation != g) {
+            g = state.generation;
+            __atomic_store_n(&state.cancel, 0, __ATOMIC_RELAXED);
+            resize(state.req_w, state.req_h);
+        } else if(state.expose) {
+            state.expose = 0;
+            if(state.samples > 0) present();
+        } else if(refining()) {
+            const size_t back = 1 - state.front;
+            const size_t w = scaled(state.w), h = scaled(state.h);
+            color_t* px = state.scale < 1 ? state.low : state.images[back].px;
+            pthread_mutex_unlock(&state.lock);
+
+            size_t n = rt_accumulate(px, w, h, 1, &state.cancel);
+            if(n > 0 && px == state.low) {
+                resample_bilinear(px, w, h,
+                                  state.images[back].px, state.w, state.h);
+            }
+
+            pthread_mutex_lock(&state.lock);
+            if(n == 0) continue;
+
+            const double c = rt_pass_ms()/(w*h);
+            state.ms_per_px = state.ms_per_px > 0
+                ? (state.ms_per_px + c)/2 : c;
+
+            state.samples = n; debug("samples: %zu", state.samples);
+            state.front = back;
+            present();
+
+            if(state.scale < 1) {
+                state.scale = MIN(MAX(2*state.scale, fitting_scale()), 1);
+                debug("scale: %.3f", state.scale);
+            }
+        } else {
+            pthread_cond_wait(&state.wake, &state.lock);
+        }
+    }
+    pthread_mutex_unlock(&state.lock);
+
+    return NULL;
+}
+
+static void render_start(void)
+{
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.wake, NULL);
+
+    int r = pthread_create(&state.renderer, NULL, render_main, NULL);
+    if(r != 0) { failwith("pthread_create(...) == %d", r); }
+}
+
+static void render_stop(void)
+{
+    pthread_mutex_lock(&state.lock);
+    state.quit = 1;
+    __atomic_store_n(&state.cancel, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&state.wake);
+    pthread_mutex_unlock(&state.lock);
+
+    int r = pthread_join(state.renderer, NULL);
+    if(r != 0) { failwith("pthread_join(...) == %d", r); }
+
+    pthread_cond_destroy(&state.wake);
+    pthread_mutex_destroy(&state.lock);
 }
 
 void run_event_loop(void)
@@ -126,6 +356,26 @@ void run_event_loop(void)
     // event loop
     xcb_generic_event_t* e; int bail = 0;
     while(!bail && (e = xcb_wait_for_event(state.con))) {
+
+        if((e->response_type & ~0x80) == 0) {
+            xcb_generic_error_t* err = (xcb_generic_error_t*)e;
+            failwith("request failed: error_code=%u major=%u minor=%u",
+                     err->error_code, err->major_code, err->minor_code);
+        }
+
+        if(state.shm_completion
+           && (e->response_type & ~0x80) == state.shm_completion) {
+            xcb_shm_completion_event_t* ev = (xcb_shm_completion_event_t*)e;
+            pthread_mutex_lock(&state.lock);
+            for(size_t i = 0; i < LENGTH(state.images); i++) {
+                if(state.images[i].seg == ev->shmseg) state.images[i].busy = 0;
+            }
+            pthread_cond_signal(&state.wake);
+            pthread_mutex_unlock(&state.lock);
+            free(e);
+            continue;
+        }
+
         switch(e->response_type & ~0x80) {
         case XCB_KEY_PRESS: {
             xcb_key_press_event_t* ev = (xcb_key_press_event_t*)e;
@@ -143,13 +393,18 @@ void run_event_loop(void)
         }
         case XCB_CONFIGURE_NOTIFY: {
             xcb_configure_notify_event_t* ev = (xcb_configure_notify_event_t*)e;
-            state.w = ev->width; state.h = ev->height;
-            state.x = ev->x; state.y = ev->y;
             info("geometry: %" PRIi16 "x%" PRIi16 "+%" PRIu16 "+%" PRIu16,
-                 state.w, state.h, state.x, state.y);
-
-            render();
+                 ev->width, ev->height, ev->x, ev->y);
 
+            pthread_mutex_lock(&state.lock);
+            state.x = ev->x; state.y = ev->y;
+            if(ev->width != state.req_w || ev->height != state.req_h) {
+                state.req_w = ev->width; state.req_h = ev->height;
+                state.generation += 1;
+                __atomic_store_n(&state.cancel, 1, __ATOMIC_RELAXED);
+                pthread_cond_signal(&state.wake);
+            }
+            pthread_mutex_unlock(&state.lock);
             break;
         }
         case XCB_EXPOSE: {
@@ -157,7 +412,13 @@ void run_event_loop(void)
             debug("expose (count=%" PRIu16 "): %" PRIu16 "x%" PRIu16
                  "+%" PRIu16 "+%" PRIu16,
                  ev->count, ev->width, ev->height, ev->x, ev->y);
-            render();
+            if(ev->count == 0) {
+                pthread_mutex_lock(&state.lock);
+                state.expose = 1;
+                pthread_cond_signal(&state.wake);
+                pthread_mutex_unlock(&state.lock);
+            }
+            break;
         }
         case XCB_MAP_NOTIFY: {
             xcb_map_notify_event_t* ev = (xcb_map_notify_event_t*)e;
@@ -180,9 +441,20 @@ void run_event_loop(void)
 
 int main(int argc, char** argv)
 {
+    const char* e = getenv("RT_SAMPLES");
+    state.max_samples = e != NULL && atoi(e) > 0 ? atoi(e) : 1024;
+
+    // the frame time target after a resize, 0 traces at the window's size
+    e = getenv("RT_FRAME_MS");
+    state.target_ms = e != NULL ? atof(e) : 100;
+
+    resample_tests();
+
     rt_setup();
     x11_init();
+    render_start();
     run_event_loop();
+    render_stop();
     x11_deinit();
     return 0;
 }
@@ -0,0 +1,12 @@
+#include <r.h>
+#include "rt.h"
+
+int main(int argc, char** argv)
+{
+    rt_setup();
+    const size_t w = 800, h = 600;
+    color_t buf[w * h];
+    rt_draw(buf, w, h);
+    rt_write_ppm(1, buf, w, h);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <r.h>
+#include "resample.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define C sizeof(color_t)
+
+// a destination coordinate lies between the source pixels i0 and i1 with
+// weight w/256 on i1
+struct tap {
+    uint32_t i0, i1;
+    uint32_t w;
+};
+
+static struct tap* taps(size_t s, size_t d)
+{
+    struct tap* t = calloc(sizeof(*t), MAX(d, 1));
+    CHECK_IF(t == NULL, "calloc");
+
+    for(size_t k = 0; k < d; k++) {
+        const float x = MAX((k + 0.5f)*s/d - 0.5f, 0);
+        const size_t i = MIN((size_t)x, s - 1);
+        t[k] = (struct tap) {
+            .i0 = i, .i1 = MIN(i + 1, s - 1),
+            .w = MIN((uint32_t)((x - i)*256 + 0.5f), 256),
+        };
+    }
+    return t;
+}
+
+// the source row i resampled horizontally, scaled by 256
+static void horizontal(const color_t src[], size_t sw, size_t i,
+                       const struct tap xs[], size_t dw, uint16_t h[])
+{
+    const uint8_t* r = (const uint8_t*)&src[i*sw];
+    for(size_t x = 0; x < dw; x++) {
+        const uint8_t* p = &r[xs[x].i0*C], *q = &r[xs[x].i1*C];
+        const uint32_t w = xs[x].w;
+        for(size_t c = 0; c < C; c++) h[x*C + c] = p[c]*(256 - w) + q[c]*w;
+    }
+}
+
+void resample_bilinear(const color_t src[], size_t sw, size_t sh,
+                       color_t dst[], size_t dw, size_t dh)
+{
+    struct tap* xs = taps(sw, dw), *ys = taps(sh, dh);
+
+    // the horizontally resampled source rows in use, the source rows of
+    // consecutive destination rows are non-decreasing
+    uint16_t* h[2]; size_t row[2] = { SIZE_MAX, SIZE_MAX };
+    for(size_t k = 0; k < 2; k++) {
+        h[k] = calloc(sizeof(uint16_t), MAX(dw*C, 1));
+        CHECK_IF(h[k] == NULL, "calloc");
+    }
+
+    for(size_t y = 0; y < dh; y++) {
+        const size_t i0 = ys[y].i0, i1 = ys[y].i1;
+        if(row[0] != i0) {
+            if(row[1] == i0) {
+                uint16_t* t = h[0]; h[0] = h[1]; h[1] = t;
+                row[1] = row[0]; row[0] = i0;
+            } else {
+                horizontal(src, sw, i0, xs, dw, h[0]); row[0] = i0;
+            }
+        }
+        if(row[1] != i1) { horizontal(src, sw, i1, xs, dw, h[1]); row[1] = i1; }
+
+        const uint16_t* a = h[0], *b = h[1];
+        const uint32_t wy = ys[y].w;
+        uint8_t* o = (uint8_t*)&dst[y*dw];
+        for(size_t k = 0; k < dw*C; k++) {
+            o[k] = (a[k]*(256 - wy) + b[k]*wy + (1 << 15)) >> 16;
+        }
+    }
+
+    free(h[0]); free(h[1]); free(xs); free(ys);
+}
+
+void resample_tests(void)
+{
+    color_t a[6], b[24];
+    for(size_t i = 0; i < LENGTH(a); i++) a[i] = color(i, 10*i, 255 - i);
+
+    // the same size is a copy
+    resample_bilinear(a, 3, 2, b, 3, 2);
+    assert(memcmp(a, b, sizeof(a)) == 0);
+
+    // a constant image stays constant
+    for(size_t i = 0; i < LENGTH(a); i++) a[i] = color(0x12, 0x34, 0xff);
+    resample_bilinear(a, 3, 2, b, 6, 4);
+    for(size_t i = 0; i < LENGTH(b); i++) {
+        assert(b[i].r == 0x12 && b[i].g == 0x34 && b[i].b == 0xff);
+    }
+
+    // a ramp is interpolated halfway between the pixel centers
+    a[0] = black; a[1] = white;
+    resample_bilinear(a, 2, 1, b, 4, 1);
+    assert(b[0].r == 0 && b[1].r == 64 && b[2].r == 191 && b[3].r == 255);
+}
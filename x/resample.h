@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "rt.h"
+
+// bilinear resampling of the sw x sh image src to the dw x dh image dst with
+// 8 bit weights and pixel centers aligned: each source row is resampled
+// horizontally once, and the destination rows are blends of two of those, a
+// loop that vectorizes
+void resample_bilinear(const color_t src[], size_t sw, size_t sh,
+                       color_t dst[], size_t dw, size_t dh);
+
+void resample_tests(void);
@@ -1,97 +1,19 @@
 #include <r.h>
 #include "rt.h"
+#include "types.h"
+#include "scene.h"
+#include "sched.h"
+#include "philox.h"
+#include "sample.h"
 
 #include <math.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
-typedef struct {
-    float x, y, z;
-} vec_t;
-
-#define vec(x, y, z) ((vec_t){ x, y, z })
-
-// p + span(b)
-typedef struct {
-    vec_t p;
-    vec_t b;
-} line_t;
-
-// forall v: (v - p) . n = 0
-typedef struct {
-    vec_t p;
-    vec_t n;
-} plane_t;
-
-// p + span(b_0, b_1)
-typedef struct {
-    vec_t p;
-    vec_t b[2];
-} grid_t;
-
-// |v - c| = r
-typedef struct {
-    vec_t c;
-    float r;
-} sphere_t;
-
-inline static __attribute__((always_inline))
-vec_t add(vec_t v, vec_t w)
-{
-    return (vec_t){ .x = v.x + w.x, .y = v.y + w.y, .z = v.z + w.z };
-}
-
-inline static __attribute__((always_inline))
-vec_t sub(vec_t v, vec_t w)
-{
-    return (vec_t){ .x = v.x - w.x, .y = v.y - w.y, .z = v.z - w.z };
-}
-
-inline static __attribute__((always_inline))
-float dot(vec_t v, vec_t w)
-{
-    return v.x*w.x + v.y*w.y + v.z*w.z;
-}
-
-inline static __attribute__((always_inline))
-vec_t cross(vec_t a, vec_t b)
-{
-    return vec(a.y*b.z - a.z*b.y, - (a.x*b.z - a.z*b.x), a.x*b.y - a.y*b.x);
-}
-
-inline static __attribute__((always_inline))
-float norm_sq(vec_t v)
-{
-    return v.x*v.x + v.y*v.y + v.z*v.z;
-}
-
-inline static __attribute__((always_inline))
-float norm(vec_t v)
-{
-    return sqrtf(norm_sq(v));
-}
-
-inline static __attribute__((always_inline))
-vec_t scalar_prod(float t, vec_t v)
-{
-    return (vec_t){ .x = t * v.x, .y = t * v.y, .z = t * v.z};
-}
-
-inline static __attribute__((always_inline))
-vec_t normalize(vec_t v)
-{
-    return scalar_prod(1/norm(v), v);
-}
-
-inline static __attribute__((always_inline))
-line_t line_from_two_points(vec_t v, vec_t w)
-{
-    return (line_t){ .p = v, .b = sub(w, v) };
-}
-
 vec_t project_point_on_line(line_t l, vec_t v)
 {
     return add(l.p, scalar_prod(dot(l.b, sub(v, l.p))/dot(l.b, l.b), l.b));
@@ -105,24 +27,6 @@ vec_t coordinates(vec_t origin, vec_t base[], float t[], size_t dim)
     return origin;
 }
 
-inline static __attribute__((always_inline))
-vec_t grid_coord(grid_t g, float s, float t)
-{
-    return vec(
-        g.p.x + s*g.b[0].x + t*g.b[1].x,
-        g.p.y + s*g.b[0].y + t*g.b[1].y,
-        g.p.z + s*g.b[0].z + t*g.b[1].z
-    );
-}
-
-inline static __attribute__((always_inline))
-vec_t line_coord(line_t l, float t)
-{
-    return add(l.p, scalar_prod(t, l.b));
-}
-
-#define eqf(a,b) (fabsf(a - b) < 1e-8)
-
 // at^2 + bt + c = 0
 int solve_2nd_order(float a, float b, float c, float t[])
 {
@@ -193,35 +97,6 @@ int intersect_line_plane(const line_t* l, const plane_t* p, float t[])
     return t[0] = u / v, 1;
 }
 
-typedef struct {
-    color_t color;
-    color_t light;
-    float dispersion;
-} material_t;
-
-typedef enum {
-    SHAPE_TYPE_SPHERE,
-    SHAPE_TYPE_PLANE,
-} shape_type_t;
-
-typedef struct {
-    union {
-        uint64_t seed;
-        unsigned int id;
-    } unique;
-
-    shape_type_t shape_type;
-    union {
-        sphere_t sphere;
-        plane_t plane;
-    } shape;
-    material_t material;
-} object_t;
-
-typedef struct {
-    object_t* objects;
-    size_t objects_len;
-} world_t;
 
 int intersect_line_object(const line_t* l, const object_t* o, float t[])
 {
@@ -235,7 +110,7 @@ int intersect_line_object(const line_t* l, const object_t* o, float t[])
     }
 }
 
-const object_t* find_collision(const line_t* l, const world_t* w, float* t, const object_t* exclude)
+static const object_t* find_collision_naive(const line_t* l, const world_t* w, float* t, const object_t* exclude)
 {
     float t_min = -1; size_t n = w->objects_len;
     for(size_t i = 0; i < w->objects_len; i++) {
@@ -263,6 +138,75 @@ const object_t* find_collision(const line_t* l, const world_t* w, float* t, cons
     }
 }
 
+const object_t* find_collision(const line_t* l, const world_t* w, float* t, const object_t* exclude)
+{
+    ssize_t n = scene_intersect(w->scene, l, t, exclude ? exclude - w->objects : -1);
+    return n < 0 ? NULL : &w->objects[n];
+}
+
+// lines tangent to a sphere hit or miss it depending on rounding
+static int grazing(const object_t* o, const line_t* l)
+{
+    if(o == NULL || o->shape_type != SHAPE_TYPE_SPHERE) return 0;
+    const sphere_t* s = &o->shape.sphere;
+    const vec_t d = sub(l->p, s->c);
+    const float b = 2*dot(l->b, d), c = norm_sq(d) - s->r*s->r;
+    return fabsf(b*b - 4*norm_sq(l->b)*c) <= 1e-5*b*b;
+}
+
+static void find_collision_tests_world(const world_t* w, vec_t camera)
+{
+    for(enum simd simd = SIMD_SCALAR; simd <= simd_detect(); simd++) {
+        world_t v = *w; v.scene = scene_compile(w, simd);
+
+        for(float y = -20; y <= 20; y += 1) {
+            for(float z = -5; z <= 15; z += 1) {
+                line_t l = line_from_two_points(camera, vec(10, y, z));
+                for(size_t i = 0; i <= MIN(w->objects_len, 5); i++) {
+                    const object_t* ex = i > 0 ? &w->objects[i - 1] : NULL;
+
+                    float s, t;
+                    const object_t* o = find_collision_naive(&l, w, &s, ex);
+                    const object_t* p = find_collision(&l, &v, &t, ex);
+                    assert(o == p || grazing(o, &l) || grazing(p, &l));
+                    assert(o != p || o == NULL || fabsf(s - t) <= 1e-3*fabsf(s));
+                }
+
+                vec_t b[SCENE_PACKET]; float ts[SCENE_PACKET]; ssize_t os[SCENE_PACKET];
+                for(size_t j = 0; j < SCENE_PACKET; j++) {
+                    b[j] = sub(vec(10, y + (j % 4)*0.25, z + (j / 4)*0.25), camera);
+                }
+                scene_intersect_packet(v.scene, camera, b, SCENE_PACKET, ts, os);
+                for(size_t j = 0; j < SCENE_PACKET; j++) {
+                    float s; line_t m = { .p = camera, .b = b[j] };
+                    const object_t* o = find_collision_naive(&m, w, &s, NULL);
+                    const object_t* p = os[j] < 0 ? NULL : &w->objects[os[j]];
+                    assert(o == p || grazing(o, &m) || grazing(p, &m));
+                    assert(o != p || o == NULL || fabsf(s - ts[j]) <= 1e-3*fabsf(s));
+                }
+            }
+        }
+
+        scene_free(v.scene);
+    }
+}
+
+// the world and the world without its spheres, whose hierarchy is empty
+static void find_collision_tests(const world_t* w, vec_t camera)
+{
+    find_collision_tests_world(w, camera);
+
+    world_t v = *w; v.objects_len = 0;
+    v.objects = calloc(sizeof(object_t), MAX(w->objects_len, 1));
+    CHECK_IF(v.objects == NULL, "calloc");
+    for(size_t i = 0; i < w->objects_len; i++) {
+        if(w->objects[i].shape_type == SHAPE_TYPE_SPHERE) continue;
+        v.objects[v.objects_len++] = w->objects[i];
+    }
+    find_collision_tests_world(&v, camera);
+    free(v.objects);
+}
+
 typedef struct {
     vec_t camera;
     grid_t plane;
@@ -364,44 +308,49 @@ static void reflect_line_object_tests(void)
     reflect_line_object_tests_sphere();
 }
 
-vec_t disperse(vec_t v, float factor, uint64_t seed)
+// known answers from the Random123 distribution
+static void philox_tests(void)
 {
-    uint64_t seeds[3];
-    memcpy(&seeds[0], &v.x, MIN(sizeof(uint64_t), sizeof(float)));
-    memcpy(&seeds[1], &v.y, MIN(sizeof(uint64_t), sizeof(float)));
-    memcpy(&seeds[2], &v.z, MIN(sizeof(uint64_t), sizeof(float)));
-    seed += seeds[0] * seeds[1] * seeds[2];
-
-    vec_t d = scalar_prod(
-        M_PI*factor,
-        vec(
-            normal_dist(&seed),
-            normal_dist(&seed),
-            normal_dist(&seed)
-        )
-    );
+    philox4_t r = philox4x32((philox4_t){ { 0 } }, (philox2_t){ { 0 } });
+    assert(r.v[0] == 0x6627e8d5 && r.v[1] == 0xe169c58d);
+    assert(r.v[2] == 0xbc57ac4c && r.v[3] == 0x9b00dbd8);
 
-    float h2 = norm_sq(v);
-
-    return vec(
-        v.x*cosf(d.x) - sqrt(h2 - v.x*v.x)*sinf(d.x),
-        v.y*cosf(d.y) - sqrt(h2 - v.y*v.y)*sinf(d.y),
-        v.z*cosf(d.z) - sqrt(h2 - v.z*v.z)*sinf(d.z)
-    );
+    r = philox4x32(
+        (philox4_t){ { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 } },
+        (philox2_t){ { 0xa4093822, 0x299f31d0 } });
+    assert(r.v[0] == 0xd16cfe09 && r.v[1] == 0x94fdcceb);
+    assert(r.v[2] == 0x5001e420 && r.v[3] == 0x24126ea1);
 }
 
-
 #define RAY_TRACE_DEPTH 20
 #define RAY_TRACE_N 10
 
-color_t ray_trace_one_line(const world_t* w, const line_t* line)
+// anti-aliasing jitters are drawn this many samples at a time
+#define RAY_TRACE_BATCH 16
+
+// the random numbers of a sample are addressed by its frame, its pixel and its
+// index among the pixel's samples, with the bounce as the draw: images are the
+// same however the samples are scheduled
+typedef struct {
+    uint32_t frame, pixel, sample;
+} sample_t;
+
+static uint32_t seed;
+
+inline static philox4_t draw(const sample_t* s, uint32_t bounce)
+{
+    return philox_draw(seed, s->frame, s->pixel, s->sample, bounce);
+}
+
+// pre-conditions: o is the first object hit by line (or NULL) at t
+static color_t ray_trace_from(const world_t* w, const line_t* line,
+                              const object_t* o, float t, const sample_t* s)
 {
     ray_collision_t cs[RAY_TRACE_DEPTH];
 
-    line_t l = *line; const object_t* o = NULL;
+    line_t l = *line;
     size_t n = 0; for(; n < RAY_TRACE_DEPTH; n++) {
-        float t;
-        o = find_collision(&l, w, &t, o);
+        if(n > 0) o = find_collision(&l, w, &t, o);
         if(o == NULL) {
             cs[n] = sky_collision(&l);
             break;
@@ -414,7 +363,8 @@ color_t ray_trace_one_line(const world_t* w, const line_t* line)
         l.b = scalar_prod(-1, l.b);
 
         l = reflect_line_object(&l, o);
-        l.b = disperse(l.b, o->material.dispersion, o->unique.seed);
+        const philox4_t r = draw(s, n + 1);
+        sample_disperse(1, o->material.dispersion, &l.b, &r, &l.b);
     }
 
     if(n == RAY_TRACE_DEPTH) { return black; }
@@ -427,30 +377,142 @@ color_t ray_trace_one_line(const world_t* w, const line_t* line)
     return c;
 }
 
-color_t ray_trace(const world_t* w, const line_t* line)
+color_t ray_trace_one_line(const world_t* w, const line_t* line,
+                           const sample_t* s)
 {
-    unsigned int c[3] = { 0 };
-    for(size_t i = 0; i < RAY_TRACE_N; i++) {
-        line_t l = *line;
-        l.b = disperse(l.b, 0.001, xorshift128plus_i());
-        color_t d = ray_trace_one_line(w, &l);
-        c[0] += d.r; c[1] += d.g; c[2] += d.b;
+    float t;
+    const object_t* o = find_collision(line, w, &t, NULL);
+    return ray_trace_from(w, line, o, t, s);
+}
+
+// adds n samples, starting with sample s0, of the pixel through line to c
+static void ray_trace(const world_t* w, const line_t* line, uint32_t frame,
+                      uint32_t pixel, size_t s0, size_t n, float c[3])
+{
+    vec_t b[RAY_TRACE_BATCH]; philox4_t r[RAY_TRACE_BATCH];
+    for(size_t i0 = 0; i0 < n; i0 += RAY_TRACE_BATCH) {
+        const size_t k = MIN(RAY_TRACE_BATCH, n - i0);
+        for(size_t i = 0; i < k; i++) {
+            const sample_t s = {
+                .frame = frame, .pixel = pixel, .sample = s0 + i0 + i,
+            };
+            b[i] = line->b; r[i] = draw(&s, 0);
+        }
+        sample_disperse(k, 0.001, b, r, b);
+
+        for(size_t i = 0; i < k; i++) {
+            const sample_t s = {
+                .frame = frame, .pixel = pixel, .sample = s0 + i0 + i,
+            };
+            const line_t l = { .p = line->p, .b = b[i] };
+            color_t d = ray_trace_one_line(w, &l, &s);
+            c[0] += d.r; c[1] += d.g; c[2] += d.b;
+        }
     }
-    return color(c[0]/RAY_TRACE_N, c[1]/RAY_TRACE_N, c[2]/RAY_TRACE_N);
 }
 
+// adds n samples, starting with sample s0, of each of the k pixels to c,
+// traced as packets of lines sharing the camera as origin: only the first
+// collision is found packet-wise
+static void ray_trace_packet(const world_t* w, vec_t camera,
+                             const line_t ls[], const size_t ps[], size_t k,
+                             uint32_t frame, size_t s0, size_t n, float c[][3])
+{
+    vec_t b[SCENE_PACKET]; float t[SCENE_PACKET]; ssize_t o[SCENE_PACKET];
+    philox4_t r[SCENE_PACKET];
+
+    for(size_t i = 0; i < n; i++) {
+        for(size_t j = 0; j < k; j++) {
+            const sample_t s = {
+                .frame = frame, .pixel = ps[j], .sample = s0 + i,
+            };
+            b[j] = ls[j].b; r[j] = draw(&s, 0);
+        }
+        sample_disperse(k, 0.001, b, r, b);
+
+        scene_intersect_packet(w->scene, camera, b, k, t, o);
+
+        for(size_t j = 0; j < k; j++) {
+            const sample_t s = {
+                .frame = frame, .pixel = ps[j], .sample = s0 + i,
+            };
+            const line_t l = { .p = camera, .b = b[j] };
+            color_t d = ray_trace_from(w, &l, o[j] < 0 ? NULL : &w->objects[o[j]], t[j], &s);
+            c[j][0] += d.r; c[j][1] += d.g; c[j][2] += d.b;
+        }
+    }
+}
+
+#define RT_TILE 32
+
 static viewport_t view;
 static world_t world;
 static struct stopwatch* stopwatch;
+static double pass_ms;
+static struct sched* sched;
+
+// per pixel sums of the samples traced since the last reset, and the index
+// of the image they belong to among those started so far
+static struct {
+    float (*c)[3];
+    size_t width, height, samples;
+    uint32_t frame, frames;
+} acc;
+
+// side of the square packets of primary rays, 0 traces them one by one
+static size_t packet = 4;
+
+static size_t rt_threads(void)
+{
+    const char* s = getenv("RT_THREADS");
+    if(s != NULL && atoi(s) > 0) return atoi(s);
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN); CHECK(n, "sysconf");
+    return n;
+}
+
+// scatter n small spheres on the plane in front of the camera, placed by
+// the seed
+static void rt_add_spheres(world_t* w, size_t n)
+{
+    w->objects = realloc(w->objects, sizeof(object_t)*(w->objects_len + n));
+    CHECK_IF(w->objects == NULL, "realloc");
+
+    const color_t colors[] = { red, green, blue, violet, orange };
+    for(size_t i = 0; i < n; i++) {
+        const philox4_t d = philox4x32((philox4_t){ { i } },
+                                       (philox2_t){ { seed, 1 } });
+        const uint64_t x = (uint64_t)d.v[0] << 32 | d.v[1];
+        const float r = 0.1 + (x & 0xff)/512.0;
+        w->objects[w->objects_len++] = (object_t) {
+            .unique.seed = (uint64_t)d.v[2] << 32 | d.v[3],
+            .shape_type = SHAPE_TYPE_SPHERE,
+            .shape.sphere = {
+                .c = vec(5 + ((x >> 8) & 0xffff)/2048.0,
+                         -20 + ((x >> 24) & 0xffff)/1638.4, r),
+                .r = r
+            },
+            .material = {
+                .light = black,
+                .color = colors[(x >> 40) % LENGTH(colors)],
+                .dispersion = ((x >> 48) & 0xff)/256.0
+            },
+        };
+    }
+}
 
 void rt_setup(void)
 {
     solve_2nd_order_tests();
     intersect_line_sphere_points_tests();
     reflect_line_object_tests();
+    philox_tests();
 
     xorshift_state_initalize();
 
+    const char* e = getenv("RT_SEED");
+    seed = e != NULL ? strtoul(e, NULL, 0) : 0;
+
     view.camera = vec(-10.0, -1, 7);
     view.plane.p = vec(0, 0, 5);
     view.plane.b[0] = vec(0, 0.01, 0);
@@ -515,29 +577,203 @@ void rt_setup(void)
         },
     };
 
+    e = getenv("RT_SPHERES");
+    if(e != NULL) rt_add_spheres(&world, atoi(e));
+
+    const enum simd simd = simd_detect();
+    world.scene = scene_compile(&world, simd);
+    sample_init(simd);
+    info("intersecting %zu objects using %s", world.objects_len, simd_name(simd));
+
     stopwatch = stopwatch_mk("rt_draw", 1);
+
+    e = getenv("RT_PACKET");
+    if(e != NULL) packet = atoi(e);
+    if(packet*packet > SCENE_PACKET) { failwith("unsupported RT_PACKET: %zu", packet); }
+
+    sched = sched_start(rt_threads());
+    info("rendering using %zu threads", sched_workers(sched));
+}
+
+// packets of a side not dividing the tiles against the lines one by one,
+// drawn with the same random numbers: no packet may spill into the next tile,
+// which would add its pixels' samples twice (the sums are compared as the
+// bright pixels saturate)
+static void packet_tests(void)
+{
+    const size_t w = 200, h = 150, n = 2, p = packet;
+    color_t* buf = calloc(sizeof(color_t), w*h);
+    float (*a)[3] = calloc(sizeof(*a), w*h);
+    CHECK_IF(buf == NULL || a == NULL, "calloc");
+
+    const uint32_t frames = acc.frames;
+    packet = 0; rt_reset(); rt_accumulate(buf, w, h, n, NULL);
+    memcpy(a, acc.c, sizeof(*a)*w*h);
+    packet = 3; rt_reset(); acc.frames = frames;
+    rt_accumulate(buf, w, h, n, NULL);
+
+    // the first collisions of the packets differ only for grazing lines
+    size_t off = 0;
+    for(size_t i = 0; i < w*h; i++) {
+        float d = 0;
+        for(size_t m = 0; m < 3; m++) d = MAX(d, fabsf(a[i][m] - acc.c[i][m]));
+        if(d > 40*n) off++;
+    }
+    assert(off <= w*h/1000);
+
+    packet = p; rt_reset();
+    free(buf); free(a);
 }
 
-void rt_draw(color_t buf[], size_t width, size_t height)
+void rt_tests(void)
 {
-    stopwatch_start(stopwatch);
+    sample_tests();
+    packet_tests();
+
+    // the naive reference is too slow for large worlds
+    if(world.objects_len <= 10000) find_collision_tests(&world, view.camera);
+}
+
+struct rt_frame {
+    color_t* buf;
+    size_t width, height;
+    size_t tiles_x;
+    uint32_t frame;
+    size_t s0, samples;
+    const int* cancel;
+    struct scene_stats stats;
+};
+
+inline static color_t resolve(const float c[3], size_t n)
+{
+    return color(c[0]/n, c[1]/n, c[2]/n);
+}
 
-    for(size_t i = 0; i < height; i++) {
-        for(size_t j = 0; j < width; j++) {
-            vec_t p = grid_coord(view.plane, (float)j - width/2, (float)i -height/2);
-            line_t l = line_from_two_points(view.camera, p);
+static void rt_draw_tile(size_t tile, size_t worker, void* opaque)
+{
+    struct rt_frame* f = opaque;
+    const size_t width = f->width, height = f->height;
+    const size_t i0 = (tile / f->tiles_x) * RT_TILE;
+    const size_t j0 = (tile % f->tiles_x) * RT_TILE;
 
-            trace("checking line: p=(%f,%f,%f) b=(%f,%f,%f)",
-                  l.p.x, l.p.y, l.p.z,
-                  l.b.x, l.b.y, l.b.z);
+    if(f->cancel != NULL && __atomic_load_n(f->cancel, __ATOMIC_RELAXED)) {
+        return;
+    }
 
-            buf[i*width + j] = ray_trace(&world, &l);
+    // the packets are cut at the tile's edges, past which another worker
+    // traces the pixels
+    const size_t i2 = MIN(i0 + RT_TILE, height), j2 = MIN(j0 + RT_TILE, width);
+    if(packet > 0) {
+        for(size_t i1 = i0; i1 < i2; i1 += packet) {
+            for(size_t j1 = j0; j1 < j2; j1 += packet) {
+                line_t ls[SCENE_PACKET]; size_t is[SCENE_PACKET], k = 0;
+                for(size_t i = i1; i < MIN(i1 + packet, i2); i++) {
+                    for(size_t j = j1; j < MIN(j1 + packet, j2); j++) {
+                        vec_t p = grid_coord(view.plane, (float)j - width/2, (float)i -height/2);
+                        ls[k] = line_from_two_points(view.camera, p);
+                        is[k++] = i*width + j;
+                    }
+                }
+
+                float cs[SCENE_PACKET][3];
+                for(size_t n = 0; n < k; n++) {
+                    for(size_t m = 0; m < 3; m++) cs[n][m] = acc.c[is[n]][m];
+                }
+                ray_trace_packet(&world, view.camera, ls, is, k, f->frame,
+                                 f->s0, f->samples, cs);
+                for(size_t n = 0; n < k; n++) {
+                    for(size_t m = 0; m < 3; m++) acc.c[is[n]][m] = cs[n][m];
+                    f->buf[is[n]] = resolve(cs[n], acc.samples);
+                }
+            }
+        }
+    } else {
+        for(size_t i = i0; i < i2; i++) {
+            for(size_t j = j0; j < j2; j++) {
+                vec_t p = grid_coord(view.plane, (float)j - width/2, (float)i -height/2);
+                line_t l = line_from_two_points(view.camera, p);
+
+                trace("checking line: p=(%f,%f,%f) b=(%f,%f,%f)",
+                      l.p.x, l.p.y, l.p.z,
+                      l.b.x, l.b.y, l.b.z);
+
+                ray_trace(&world, &l, f->frame, i*width + j, f->s0, f->samples,
+                          acc.c[i*width + j]);
+                f->buf[i*width + j] = resolve(acc.c[i*width + j], acc.samples);
+            }
         }
     }
 
+    scene_stats_flush(&f->stats);
+}
+
+void rt_reset(void)
+{
+    acc.samples = 0;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    int r = clock_gettime(CLOCK_MONOTONIC, &ts);
+    CHECK(r, "clock_gettime");
+    return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+double rt_pass_ms(void)
+{
+    return pass_ms;
+}
+
+size_t rt_accumulate(color_t buf[], size_t width, size_t height,
+                     size_t samples, const int* cancel)
+{
+    if(width != acc.width || height != acc.height) {
+        free(acc.c);
+        acc.c = calloc(sizeof(*acc.c), MAX(width*height, 1));
+        CHECK_IF(acc.c == NULL, "calloc");
+        acc.width = width; acc.height = height; acc.samples = 0;
+    } else if(acc.samples == 0) {
+        memset(acc.c, 0, sizeof(*acc.c)*width*height);
+    }
+    if(acc.samples == 0) acc.frame = acc.frames++;
+
+    stopwatch_start(stopwatch);
+    const double t0 = now_ms();
+
+    struct rt_frame f = {
+        .buf = buf, .width = width, .height = height,
+        .tiles_x = (width + RT_TILE - 1) / RT_TILE,
+        .frame = acc.frame, .s0 = acc.samples, .samples = samples,
+        .cancel = cancel,
+    };
+    acc.samples += samples;
+    const size_t tiles_y = (height + RT_TILE - 1) / RT_TILE;
+    sched_run(sched, f.tiles_x * tiles_y, rt_draw_tile, &f);
+
     stopwatch_stop(stopwatch);
+    const double t1 = now_ms();
+
+    // the skipped tiles' sums are short of samples
+    if(cancel != NULL && __atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+        debug("accumulation cancelled");
+        acc.samples = 0;
+        return 0;
+    }
+    pass_ms = t1 - t0;
+
+    const double n = MAX(f.stats.traversals, 1);
+    debug("bvh: traversals=%lu nodes/traversal=%.1f leaves/traversal=%.1f",
+         f.stats.traversals, f.stats.nodes/n, f.stats.leaves/n);
+
+    return acc.samples;
 }
 
+void rt_draw(color_t buf[], size_t width, size_t height)
+{
+    rt_reset();
+    rt_accumulate(buf, width, height, RAY_TRACE_N, NULL);
+}
 
 void rt_write_ppm(int fd, const color_t buf[], size_t width, size_t height)
 {
@@ -553,13 +789,3 @@ void rt_write_ppm(int fd, const color_t buf[], size_t width, size_t height)
 
     r = close(fd); CHECK(r, "close");
 }
-
-int main(int argc, char** argv)
-{
-    rt_setup();
-    const size_t w = 800, h = 600;
-    color_t buf[w * h];
-    rt_draw(buf, w, h);
-    rt_write_ppm(1, buf, w, h);
-    return 0;
-}
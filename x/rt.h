@@ -24,4 +24,24 @@ typedef struct {
 #define orange color(0xff, 0x80, 0x00)
 
 void rt_setup(void);
-void rt_draw(color_t buf[], size_t height, size_t width);
+
+// checks the sampling and the scene's intersections against their references
+// in the world set up by rt_setup, too slow to run on every start
+void rt_tests(void);
+void rt_draw(color_t buf[], size_t width, size_t height);
+
+// progressive rendering: adds samples per pixel to a persistent accumulation
+// buffer and writes the running average to buf, returns the number of
+// samples accumulated so far; the buffer is cleared by rt_reset and when the
+// size changes
+//
+// setting *cancel (if not NULL) from another thread stops the pass early,
+// which clears the buffer and returns 0
+size_t rt_accumulate(color_t buf[], size_t width, size_t height,
+                     size_t samples, const int* cancel);
+void rt_reset(void);
+
+// wall time of the last rt_accumulate pass that was not cancelled
+double rt_pass_ms(void);
+
+void rt_write_ppm(int fd, const color_t buf[], size_t width, size_t height);
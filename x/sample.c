@@ -0,0 +1,247 @@
+#include <r.h>
+#include "sample.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+// the approximations are branch free so that the loops over a batch are
+// vectorized, their error bounds are asserted by sample_tests:
+//  - sample_sincos: absolute error below 2^-23 for |x| < 8192 (Cody-Waite
+//    reduction by pi/4 and the minimax polynomials of Cephes' sinf/cosf)
+//  - sample_log: relative error below 2^-23 for normal x > 0 (Cephes' logf)
+//  - sample_sqrt: relative error below 2^-22 for normal x >= 0 (three Newton
+//    steps from the bit level estimate of 1/sqrt(x))
+
+inline static __attribute__((always_inline))
+int32_t as_int(float x)
+{
+    int32_t i; memcpy(&i, &x, sizeof(i)); return i;
+}
+
+inline static __attribute__((always_inline))
+float as_float(int32_t i)
+{
+    float x; memcpy(&x, &i, sizeof(x)); return x;
+}
+
+// philox_uniform by a signed conversion, which all the instruction sets have
+inline static __attribute__((always_inline))
+float uniform(uint32_t x)
+{
+    return (int32_t)(x >> 8) * (1.0f / 16777216);
+}
+
+inline static __attribute__((always_inline))
+void sample_sincos(float x, float* s, float* c)
+{
+    const float y = fabsf(x);
+
+    // the octant rounded up to even, y reduced to [-pi/4, pi/4] around it
+    const int32_t j = ((int32_t)(y * (float)(4/M_PI)) + 1) & ~1;
+    const float J = j;
+    const float r = ((y - J*0.78515625f) - J*2.4187564849853515625e-4f)
+        - J*3.77489497744594108e-8f;
+    const float z = r*r;
+
+    const float S = ((-1.9515295891e-4f*z + 8.3321608736e-3f)*z
+                     - 1.6666654611e-1f)*z*r + r;
+    const float C = ((2.443315711809948e-5f*z - 1.388731625493765e-3f)*z
+                     + 4.166664568298827e-2f)*z*z - 0.5f*z + 1;
+
+    // quadrant q: sin = S, C, -S, -C and cos = C, -S, -C, S, selected and
+    // negated by masks on the bits
+    const int32_t q = j >> 1, swap = -(q & 1);
+    const int32_t u = (as_int(C) & swap) | (as_int(S) & ~swap);
+    const int32_t v = (as_int(S) & swap) | (as_int(C) & ~swap);
+    *s = as_float(u ^ (q & 2) << 30 ^ (as_int(x) & INT32_MIN));
+    *c = as_float(v ^ ((q + 1) & 2) << 30);
+}
+
+inline static __attribute__((always_inline))
+float sample_log(float x)
+{
+    // x = m 2^e with m in [sqrt(1/2), sqrt(2))
+    const int32_t i = as_int(x);
+    const int32_t k = (i & 0x807fffff) | 0x3f000000;
+    const int32_t lo = (k - as_int(M_SQRT1_2)) >> 31; // -1 if m < sqrt(1/2)
+    const float e = ((i >> 23) & 0xff) - 126 + lo;
+    const float m = as_float(k) + as_float(k & lo) - 1;
+
+    const float z = m*m;
+    float y = ((((((((7.0376836292e-2f*m - 1.1514610310e-1f)*m
+                     + 1.1676998740e-1f)*m - 1.2420140846e-1f)*m
+                   + 1.4249322787e-1f)*m - 1.6668057665e-1f)*m
+                 + 2.0000714765e-1f)*m - 2.4999993993e-1f)*m
+               + 3.3333331174e-1f)*m*z;
+    y += -2.12194440e-4f*e - 0.5f*z;
+    return m + y + 0.693359375f*e;
+}
+
+// max(x, 0) by masking the sign, for lanes that lose a last bit below zero
+inline static __attribute__((always_inline))
+float positive(float x)
+{
+    return as_float(as_int(x) & ~(as_int(x) >> 31));
+}
+
+inline static __attribute__((always_inline))
+float sample_sqrt(float x)
+{
+    float y = as_float(0x5f375a86 - (as_int(x) >> 1));
+    for(int k = 0; k < 3; k++) y = y*(1.5f - 0.5f*x*y*y);
+    return x*y;
+}
+
+#define SAMPLE_BLOCK 16
+
+// the batch is worked on in blocks transposed to structures of arrays
+inline static __attribute__((always_inline))
+void disperse(size_t n, float factor, const vec_t v[], const philox4_t r[],
+              vec_t out[])
+{
+    const float f = M_PI*factor, tau = 2*M_PI;
+    for(size_t i0 = 0; i0 < n; i0 += SAMPLE_BLOCK) {
+        const size_t m = MIN(SAMPLE_BLOCK, n - i0);
+
+        float x[SAMPLE_BLOCK], y[SAMPLE_BLOCK], z[SAMPLE_BLOCK];
+        uint32_t u[4][SAMPLE_BLOCK];
+        for(size_t i = 0; i < m; i++) {
+            x[i] = v[i0 + i].x; y[i] = v[i0 + i].y; z[i] = v[i0 + i].z;
+            for(size_t k = 0; k < 4; k++) u[k][i] = r[i0 + i].v[k];
+        }
+
+        for(size_t i = 0; i < m; i++) {
+            const float a = sample_sqrt(-2*sample_log(1 - uniform(u[0][i])));
+            const float b = sample_sqrt(-2*sample_log(1 - uniform(u[2][i])));
+
+            float sp, cp, sq, cq;
+            sample_sincos(tau*uniform(u[1][i]), &sp, &cp);
+            sample_sincos(tau*uniform(u[3][i]), &sq, &cq);
+
+            float sx, cx, sy, cy, sz, cz;
+            sample_sincos(f*a*cp, &sx, &cx);
+            sample_sincos(f*a*sp, &sy, &cy);
+            sample_sincos(f*b*cq, &sz, &cz);
+
+            const float h2 = x[i]*x[i] + y[i]*y[i] + z[i]*z[i];
+            x[i] = x[i]*cx - sample_sqrt(positive(h2 - x[i]*x[i]))*sx;
+            y[i] = y[i]*cy - sample_sqrt(positive(h2 - y[i]*y[i]))*sy;
+            z[i] = z[i]*cz - sample_sqrt(positive(h2 - z[i]*z[i]))*sz;
+        }
+
+        for(size_t i = 0; i < m; i++) out[i0 + i] = vec(x[i], y[i], z[i]);
+    }
+}
+
+typedef void (*kernel_t)(size_t n, float factor, const vec_t v[],
+                         const philox4_t r[], vec_t out[]);
+
+static void disperse_scalar(size_t n, float factor, const vec_t v[],
+                            const philox4_t r[], vec_t out[])
+{
+    disperse(n, factor, v, r, out);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void disperse_sse(size_t n, float factor, const vec_t v[],
+                         const philox4_t r[], vec_t out[])
+{
+    disperse(n, factor, v, r, out);
+}
+
+__attribute__((target("avx2")))
+static void disperse_avx(size_t n, float factor, const vec_t v[],
+                         const philox4_t r[], vec_t out[])
+{
+    disperse(n, factor, v, r, out);
+}
+
+__attribute__((target("avx512f")))
+static void disperse_avx512(size_t n, float factor, const vec_t v[],
+                            const philox4_t r[], vec_t out[])
+{
+    disperse(n, factor, v, r, out);
+}
+#endif
+
+static kernel_t kernel = disperse_scalar;
+
+void sample_init(enum simd simd)
+{
+    switch(simd) {
+#if defined(__x86_64__) || defined(__i386__)
+    case SIMD_AVX512: kernel = disperse_avx512; break;
+    case SIMD_AVX: kernel = disperse_avx; break;
+    case SIMD_SSE: kernel = disperse_sse; break;
+#endif
+    default: kernel = disperse_scalar; break;
+    }
+}
+
+void sample_disperse(size_t n, float factor, const vec_t v[],
+                     const philox4_t r[], vec_t out[])
+{
+    kernel(n, factor, v, r, out);
+}
+
+void sample_disperse_libm(size_t n, float factor, const vec_t v[],
+                          const philox4_t r[], vec_t out[])
+{
+    for(size_t i = 0; i < n; i++) {
+        const float a = sqrtf(-2*logf(1 - philox_uniform(r[i].v[0])));
+        const float b = sqrtf(-2*logf(1 - philox_uniform(r[i].v[2])));
+        const float p = 2*M_PI*philox_uniform(r[i].v[1]);
+        const float q = 2*M_PI*philox_uniform(r[i].v[3]);
+
+        const vec_t d = scalar_prod(M_PI*factor,
+                                    vec(a*cosf(p), a*sinf(p), b*cosf(q)));
+
+        const vec_t w = v[i]; const float h2 = norm_sq(w);
+        out[i] = vec(
+            w.x*cosf(d.x) - sqrtf(MAX(h2 - w.x*w.x, 0))*sinf(d.x),
+            w.y*cosf(d.y) - sqrtf(MAX(h2 - w.y*w.y, 0))*sinf(d.y),
+            w.z*cosf(d.z) - sqrtf(MAX(h2 - w.z*w.z, 0))*sinf(d.z)
+        );
+    }
+}
+
+void sample_tests(void)
+{
+    const double eps = 1.0/(1 << 23);
+
+    for(float x = -8192; x < 8192; x += 0.0137f) {
+        float s, c; sample_sincos(x, &s, &c);
+        assert(fabs(s - sin(x)) < eps && fabs(c - cos(x)) < eps);
+    }
+
+    for(float x = 1.0f/(1 << 24); x <= 1 << 24; x *= 1.0007f) {
+        assert(fabs(sample_log(x) - log(x)) <= eps*fabs(log(x)));
+        assert(fabs(sample_sqrt(x) - sqrt(x)) <= 2*eps*sqrt(x));
+    }
+    assert(sample_log(1) == 0 && sample_sqrt(0) == 0);
+
+    // the kernels against the C library, over the whole range of draws
+    philox4_t r[64]; vec_t v[LENGTH(r)], a[LENGTH(r)], b[LENGTH(r)];
+    for(size_t i = 0; i < LENGTH(r); i++) {
+        r[i] = philox4x32((philox4_t){ { i } }, (philox2_t){ { 0 } });
+        v[i] = vec((int32_t)r[i].v[0]/2e9f, (int32_t)r[i].v[1]/2e9f,
+                   (int32_t)r[i].v[2]/2e9f);
+    }
+    r[0].v[0] = r[0].v[2] = UINT32_MAX; r[1].v[0] = r[1].v[2] = 0;
+
+    for(enum simd simd = SIMD_SCALAR; simd <= simd_detect(); simd++) {
+        sample_init(simd);
+        for(float f = 0.001f; f < 4; f *= 4) {
+            sample_disperse(LENGTH(r), f, v, r, a);
+            sample_disperse_libm(LENGTH(r), f, v, r, b);
+            for(size_t i = 0; i < LENGTH(r); i++) {
+                assert(fabsf(a[i].x - b[i].x) < 1e-5f);
+                assert(fabsf(a[i].y - b[i].y) < 1e-5f);
+                assert(fabsf(a[i].z - b[i].z) < 1e-5f);
+            }
+        }
+    }
+    sample_init(SIMD_SCALAR);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "types.h"
+#include "simd.h"
+#include "philox.h"
+
+// batched sampling: directions for many lines at a time, with branch free
+// polynomial approximations of the transcendentals evaluated by kernels
+// compiled for each instruction set, picked by sample_init (scalar until then)
+void sample_init(enum simd simd);
+
+// out[i] is v[i] turned by normally distributed angles with deviation
+// pi*factor around each axis, drawn from r[i] by Box-Muller; out may be v
+void sample_disperse(size_t n, float factor, const vec_t v[],
+                     const philox4_t r[], vec_t out[]);
+
+// the same with the C library's functions, which the approximations are
+// tested and benchmarked against
+void sample_disperse_libm(size_t n, float factor, const vec_t v[],
+                          const philox4_t r[], vec_t out[]);
+
+// asserts the documented error bounds
+void sample_tests(void);
@@ -0,0 +1,825 @@
+#include <r.h>
+#include "scene.h"
+#include "bvh.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCENE_X86
+#endif
+
+// arrays are padded to the widest kernel, padding spheres have r^2 = -inf and
+// padding planes a NaN point so that they never produce a hit
+#define SCENE_ALIGN 64
+#define SCENE_PAD 16
+
+typedef struct {
+    float t;
+    int32_t o;
+} hit_t;
+
+// nearest hit among the objects in [i0, i1) that is nearer than h, or h
+typedef hit_t (*kernel_t)(const struct scene* s, const line_t* l,
+                          int32_t exclude, size_t i0, size_t i1, hit_t h);
+
+typedef struct packet_t packet_t;
+
+// bounding volume hierarchy traversal stack, deeper trees are rejected
+#define SCENE_STACK 128
+
+struct scene {
+    // spheres are stored in the order of the hierarchy's slots: its leaves
+    // are contiguous runs padded to the width of the kernels
+    struct bvh* bvh;
+    size_t spheres_len;
+    float* cx, *cy, *cz, *r2;
+    int32_t* sphere_object;
+
+    size_t planes_len;
+    float* px, *py, *pz, *nx, *ny, *nz;
+    int32_t* plane_object;
+
+    kernel_t spheres, planes;
+    void (*packet)(const struct scene* s, const packet_t* P,
+                   size_t i0, size_t i1, float T[], int32_t O[]);
+};
+
+static _Thread_local struct scene_stats stats;
+
+inline static size_t padded(size_t n)
+{
+    return MAX((n + SCENE_PAD - 1) / SCENE_PAD, 1) * SCENE_PAD;
+}
+
+static void* scene_alloc(size_t n, size_t size)
+{
+    void* p = aligned_alloc(SCENE_ALIGN, padded(n) * size);
+    CHECK_IF(p == NULL, "aligned_alloc");
+    return p;
+}
+
+inline static __attribute__((always_inline))
+hit_t nearest(hit_t a, hit_t b)
+{
+    if(b.o < 0) return a;
+    if(a.o < 0) return b;
+    return b.t < a.t || (b.t == a.t && b.o < a.o) ? b : a;
+}
+
+// lanes without a hit have o = -1 and are ignored, ties go to the lowest
+// object index
+static hit_t reduce(const float t[], const int32_t o[], size_t n)
+{
+    float m = INFINITY;
+    for(size_t i = 0; i < n; i++) m = o[i] >= 0 && t[i] < m ? t[i] : m;
+
+    uint32_t k = UINT32_MAX;
+    for(size_t i = 0; i < n; i++) {
+        k = o[i] >= 0 && t[i] == m && (uint32_t)o[i] < k ? o[i] : k;
+    }
+    return (hit_t){ .t = m, .o = k == UINT32_MAX ? -1 : (int32_t)k };
+}
+
+static hit_t spheres_scalar(const struct scene* s, const line_t* l,
+                            int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    const float a = norm_sq(l->b);
+    for(size_t i = i0; i < i1; i++) {
+        if(s->sphere_object[i] == exclude) continue;
+
+        const vec_t d = sub(l->p, vec(s->cx[i], s->cy[i], s->cz[i]));
+        const float b = 2*dot(l->b, d), c = norm_sq(d) - s->r2[i];
+        const float D = b*b - 4*a*c;
+        if(D < 0) continue;
+
+        const float t = (-b - sqrtf(D)) / (2*a);
+        if(t >= 0 && t < h.t) { h.t = t; h.o = s->sphere_object[i]; }
+    }
+    return h;
+}
+
+static hit_t planes_scalar(const struct scene* s, const line_t* l,
+                           int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    for(size_t i = i0; i < i1; i++) {
+        if(s->plane_object[i] == exclude) continue;
+
+        const vec_t n = vec(s->nx[i], s->ny[i], s->nz[i]);
+        const float u = dot(sub(vec(s->px[i], s->py[i], s->pz[i]), l->p), n);
+        const float v = dot(l->b, n);
+
+        float t;
+        if(eqf(u, 0)) t = 0; // line is in the plane
+        else if(eqf(v, 0)) continue; // line is parallel
+        else t = u / v;
+
+        if(t >= 0 && t < h.t) { h.t = t; h.o = s->plane_object[i]; }
+    }
+    return h;
+}
+
+#ifdef SCENE_X86
+
+__attribute__((target("sse2")))
+static hit_t spheres_sse(const struct scene* s, const line_t* l,
+                         int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    const float a = norm_sq(l->b);
+    const __m128 px = _mm_set1_ps(l->p.x), py = _mm_set1_ps(l->p.y),
+                 pz = _mm_set1_ps(l->p.z);
+    const __m128 bx = _mm_set1_ps(l->b.x), by = _mm_set1_ps(l->b.y),
+                 bz = _mm_set1_ps(l->b.z);
+    const __m128 a4 = _mm_set1_ps(4*a), inv2a = _mm_set1_ps(1/(2*a));
+    const __m128 zero = _mm_setzero_ps(), two = _mm_set1_ps(2);
+    const __m128i ex = _mm_set1_epi32(exclude);
+
+    __m128 T = _mm_set1_ps(h.t); __m128i O = _mm_set1_epi32(-1);
+    for(size_t i = i0; i < i1; i += 4) {
+        const __m128 dx = _mm_sub_ps(px, _mm_load_ps(s->cx + i));
+        const __m128 dy = _mm_sub_ps(py, _mm_load_ps(s->cy + i));
+        const __m128 dz = _mm_sub_ps(pz, _mm_load_ps(s->cz + i));
+
+        const __m128 b = _mm_mul_ps(two, _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(bx, dx), _mm_mul_ps(by, dy)), _mm_mul_ps(bz, dz)));
+        const __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)),
+            _mm_load_ps(s->r2 + i));
+        const __m128 D = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a4, c));
+
+        const __m128 t = _mm_mul_ps(
+            _mm_sub_ps(_mm_sub_ps(zero, b), _mm_sqrt_ps(_mm_max_ps(D, zero))),
+            inv2a);
+
+        const __m128i o = _mm_load_si128((const __m128i*)(s->sphere_object + i));
+        const __m128 m = _mm_andnot_ps(
+            _mm_castsi128_ps(_mm_cmpeq_epi32(o, ex)),
+            _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(D, zero), _mm_cmpge_ps(t, zero)),
+                       _mm_cmplt_ps(t, T)));
+
+        T = _mm_or_ps(_mm_and_ps(m, t), _mm_andnot_ps(m, T));
+        O = _mm_or_si128(_mm_and_si128(_mm_castps_si128(m), o),
+                         _mm_andnot_si128(_mm_castps_si128(m), O));
+    }
+
+    float ts[4]; int32_t os[4];
+    _mm_storeu_ps(ts, T); _mm_storeu_si128((__m128i*)os, O);
+    return nearest(h, reduce(ts, os, 4));
+}
+
+__attribute__((target("sse2")))
+static hit_t planes_sse(const struct scene* s, const line_t* l,
+                        int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    const __m128 px = _mm_set1_ps(l->p.x), py = _mm_set1_ps(l->p.y),
+                 pz = _mm_set1_ps(l->p.z);
+    const __m128 bx = _mm_set1_ps(l->b.x), by = _mm_set1_ps(l->b.y),
+                 bz = _mm_set1_ps(l->b.z);
+    const __m128 zero = _mm_setzero_ps(), eps = _mm_set1_ps(1e-8);
+    const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128i ex = _mm_set1_epi32(exclude);
+
+    __m128 T = _mm_set1_ps(h.t); __m128i O = _mm_set1_epi32(-1);
+    for(size_t i = i0; i < i1; i += 4) {
+        const __m128 nx = _mm_load_ps(s->nx + i), ny = _mm_load_ps(s->ny + i),
+                     nz = _mm_load_ps(s->nz + i);
+
+        const __m128 u = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_sub_ps(_mm_load_ps(s->px + i), px), nx),
+            _mm_mul_ps(_mm_sub_ps(_mm_load_ps(s->py + i), py), ny)),
+            _mm_mul_ps(_mm_sub_ps(_mm_load_ps(s->pz + i), pz), nz));
+        const __m128 v = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(bx, nx), _mm_mul_ps(by, ny)), _mm_mul_ps(bz, nz));
+
+        const __m128 in = _mm_cmplt_ps(_mm_and_ps(u, abs), eps);
+        const __m128 parallel = _mm_cmplt_ps(_mm_and_ps(v, abs), eps);
+        const __m128 t = _mm_andnot_ps(in, _mm_div_ps(u, v));
+
+        const __m128i o = _mm_load_si128((const __m128i*)(s->plane_object + i));
+        const __m128 m = _mm_andnot_ps(
+            _mm_castsi128_ps(_mm_cmpeq_epi32(o, ex)),
+            _mm_and_ps(_mm_or_ps(in, _mm_andnot_ps(parallel,
+                                                   _mm_cmpge_ps(t, zero))),
+                       _mm_cmplt_ps(t, T)));
+
+        T = _mm_or_ps(_mm_and_ps(m, t), _mm_andnot_ps(m, T));
+        O = _mm_or_si128(_mm_and_si128(_mm_castps_si128(m), o),
+                         _mm_andnot_si128(_mm_castps_si128(m), O));
+    }
+
+    float ts[4]; int32_t os[4];
+    _mm_storeu_ps(ts, T); _mm_storeu_si128((__m128i*)os, O);
+    return nearest(h, reduce(ts, os, 4));
+}
+
+__attribute__((target("avx2")))
+static hit_t spheres_avx(const struct scene* s, const line_t* l,
+                         int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    const float a = norm_sq(l->b);
+    const __m256 px = _mm256_set1_ps(l->p.x), py = _mm256_set1_ps(l->p.y),
+                 pz = _mm256_set1_ps(l->p.z);
+    const __m256 bx = _mm256_set1_ps(l->b.x), by = _mm256_set1_ps(l->b.y),
+                 bz = _mm256_set1_ps(l->b.z);
+    const __m256 a4 = _mm256_set1_ps(4*a), inv2a = _mm256_set1_ps(1/(2*a));
+    const __m256 zero = _mm256_setzero_ps(), two = _mm256_set1_ps(2);
+    const __m256i ex = _mm256_set1_epi32(exclude);
+
+    __m256 T = _mm256_set1_ps(h.t); __m256i O = _mm256_set1_epi32(-1);
+    for(size_t i = i0; i < i1; i += 8) {
+        const __m256 dx = _mm256_sub_ps(px, _mm256_load_ps(s->cx + i));
+        const __m256 dy = _mm256_sub_ps(py, _mm256_load_ps(s->cy + i));
+        const __m256 dz = _mm256_sub_ps(pz, _mm256_load_ps(s->cz + i));
+
+        const __m256 b = _mm256_mul_ps(two, _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(bx, dx), _mm256_mul_ps(by, dy)),
+            _mm256_mul_ps(bz, dz)));
+        const __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+            _mm256_mul_ps(dz, dz)), _mm256_load_ps(s->r2 + i));
+        const __m256 D = _mm256_sub_ps(_mm256_mul_ps(b, b),
+                                       _mm256_mul_ps(a4, c));
+
+        const __m256 t = _mm256_mul_ps(_mm256_sub_ps(
+            _mm256_sub_ps(zero, b), _mm256_sqrt_ps(_mm256_max_ps(D, zero))),
+            inv2a);
+
+        const __m256i o = _mm256_load_si256(
+            (const __m256i*)(s->sphere_object + i));
+        const __m256 m = _mm256_andnot_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(o, ex)),
+            _mm256_and_ps(_mm256_and_ps(
+                _mm256_cmp_ps(D, zero, _CMP_GE_OQ),
+                _mm256_cmp_ps(t, zero, _CMP_GE_OQ)),
+                _mm256_cmp_ps(t, T, _CMP_LT_OQ)));
+
+        T = _mm256_blendv_ps(T, t, m);
+        O = _mm256_blendv_epi8(O, o, _mm256_castps_si256(m));
+    }
+
+    float ts[8]; int32_t os[8];
+    _mm256_storeu_ps(ts, T); _mm256_storeu_si256((__m256i*)os, O);
+    return nearest(h, reduce(ts, os, 8));
+}
+
+__attribute__((target("avx2")))
+static hit_t planes_avx(const struct scene* s, const line_t* l,
+                        int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    const __m256 px = _mm256_set1_ps(l->p.x), py = _mm256_set1_ps(l->p.y),
+                 pz = _mm256_set1_ps(l->p.z);
+    const __m256 bx = _mm256_set1_ps(l->b.x), by = _mm256_set1_ps(l->b.y),
+                 bz = _mm256_set1_ps(l->b.z);
+    const __m256 zero = _mm256_setzero_ps(), eps = _mm256_set1_ps(1e-8);
+    const __m256 abs = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256i ex = _mm256_set1_epi32(exclude);
+
+    __m256 T = _mm256_set1_ps(h.t); __m256i O = _mm256_set1_epi32(-1);
+    for(size_t i = i0; i < i1; i += 8) {
+        const __m256 nx = _mm256_load_ps(s->nx + i),
+                     ny = _mm256_load_ps(s->ny + i),
+                     nz = _mm256_load_ps(s->nz + i);
+
+        const __m256 u = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(s->px + i), px), nx),
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(s->py + i), py), ny)),
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(s->pz + i), pz), nz));
+        const __m256 v = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(bx, nx), _mm256_mul_ps(by, ny)),
+            _mm256_mul_ps(bz, nz));
+
+        const __m256 in = _mm256_cmp_ps(_mm256_and_ps(u, abs), eps,
+                                        _CMP_LT_OQ);
+        const __m256 parallel = _mm256_cmp_ps(_mm256_and_ps(v, abs), eps,
+                                              _CMP_LT_OQ);
+        const __m256 t = _mm256_andnot_ps(in, _mm256_div_ps(u, v));
+
+        const __m256i o = _mm256_load_si256(
+            (const __m256i*)(s->plane_object + i));
+        const __m256 m = _mm256_andnot_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(o, ex)),
+            _mm256_and_ps(_mm256_or_ps(in, _mm256_andnot_ps(parallel,
+                _mm256_cmp_ps(t, zero, _CMP_GE_OQ))),
+                _mm256_cmp_ps(t, T, _CMP_LT_OQ)));
+
+        T = _mm256_blendv_ps(T, t, m);
+        O = _mm256_blendv_epi8(O, o, _mm256_castps_si256(m));
+    }
+
+    float ts[8]; int32_t os[8];
+    _mm256_storeu_ps(ts, T); _mm256_storeu_si256((__m256i*)os, O);
+    return nearest(h, reduce(ts, os, 8));
+}
+
+__attribute__((target("avx512f")))
+static hit_t spheres_avx512(const struct scene* s, const line_t* l,
+                            int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    const float a = norm_sq(l->b);
+    const __m512 px = _mm512_set1_ps(l->p.x), py = _mm512_set1_ps(l->p.y),
+                 pz = _mm512_set1_ps(l->p.z);
+    const __m512 bx = _mm512_set1_ps(l->b.x), by = _mm512_set1_ps(l->b.y),
+                 bz = _mm512_set1_ps(l->b.z);
+    const __m512 a4 = _mm512_set1_ps(4*a), inv2a = _mm512_set1_ps(1/(2*a));
+    const __m512 zero = _mm512_setzero_ps(), two = _mm512_set1_ps(2);
+    const __m512i ex = _mm512_set1_epi32(exclude);
+
+    __m512 T = _mm512_set1_ps(h.t); __m512i O = _mm512_set1_epi32(-1);
+    for(size_t i = i0; i < i1; i += 16) {
+        const __m512 dx = _mm512_sub_ps(px, _mm512_load_ps(s->cx + i));
+        const __m512 dy = _mm512_sub_ps(py, _mm512_load_ps(s->cy + i));
+        const __m512 dz = _mm512_sub_ps(pz, _mm512_load_ps(s->cz + i));
+
+        const __m512 b = _mm512_mul_ps(two, _mm512_fmadd_ps(bz, dz,
+            _mm512_fmadd_ps(by, dy, _mm512_mul_ps(bx, dx))));
+        const __m512 c = _mm512_sub_ps(_mm512_fmadd_ps(dz, dz,
+            _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx))),
+            _mm512_load_ps(s->r2 + i));
+        const __m512 D = _mm512_fnmadd_ps(a4, c, _mm512_mul_ps(b, b));
+
+        const __m512 t = _mm512_mul_ps(_mm512_sub_ps(
+            _mm512_sub_ps(zero, b), _mm512_sqrt_ps(_mm512_max_ps(D, zero))),
+            inv2a);
+
+        const __m512i o = _mm512_load_si512(s->sphere_object + i);
+        const __mmask16 m = _mm512_cmpneq_epi32_mask(o, ex)
+            & _mm512_cmp_ps_mask(D, zero, _CMP_GE_OQ)
+            & _mm512_cmp_ps_mask(t, zero, _CMP_GE_OQ)
+            & _mm512_cmp_ps_mask(t, T, _CMP_LT_OQ);
+
+        T = _mm512_mask_blend_ps(m, T, t);
+        O = _mm512_mask_blend_epi32(m, O, o);
+    }
+
+    float ts[16]; int32_t os[16];
+    _mm512_storeu_ps(ts, T); _mm512_storeu_si512(os, O);
+    return nearest(h, reduce(ts, os, 16));
+}
+
+__attribute__((target("avx512f")))
+static hit_t planes_avx512(const struct scene* s, const line_t* l,
+                           int32_t exclude, size_t i0, size_t i1, hit_t h)
+{
+    const __m512 px = _mm512_set1_ps(l->p.x), py = _mm512_set1_ps(l->p.y),
+                 pz = _mm512_set1_ps(l->p.z);
+    const __m512 bx = _mm512_set1_ps(l->b.x), by = _mm512_set1_ps(l->b.y),
+                 bz = _mm512_set1_ps(l->b.z);
+    const __m512 zero = _mm512_setzero_ps(), eps = _mm512_set1_ps(1e-8);
+    const __m512i ex = _mm512_set1_epi32(exclude);
+
+    __m512 T = _mm512_set1_ps(h.t); __m512i O = _mm512_set1_epi32(-1);
+    for(size_t i = i0; i < i1; i += 16) {
+        const __m512 nx = _mm512_load_ps(s->nx + i),
+                     ny = _mm512_load_ps(s->ny + i),
+                     nz = _mm512_load_ps(s->nz + i);
+
+        const __m512 u = _mm512_fmadd_ps(
+            _mm512_sub_ps(_mm512_load_ps(s->pz + i), pz), nz,
+            _mm512_fmadd_ps(
+                _mm512_sub_ps(_mm512_load_ps(s->py + i), py), ny,
+                _mm512_mul_ps(_mm512_sub_ps(_mm512_load_ps(s->px + i), px),
+                              nx)));
+        const __m512 v = _mm512_fmadd_ps(bz, nz,
+            _mm512_fmadd_ps(by, ny, _mm512_mul_ps(bx, nx)));
+
+        const __mmask16 in = _mm512_cmp_ps_mask(_mm512_abs_ps(u), eps,
+                                                _CMP_LT_OQ);
+        const __mmask16 parallel = _mm512_cmp_ps_mask(_mm512_abs_ps(v), eps,
+                                                      _CMP_LT_OQ);
+        const __m512 t = _mm512_mask_blend_ps(in, _mm512_div_ps(u, v), zero);
+
+        const __m512i o = _mm512_load_si512(s->plane_object + i);
+        const __mmask16 m = _mm512_cmpneq_epi32_mask(o, ex)
+            & (in | (~parallel & _mm512_cmp_ps_mask(t, zero, _CMP_GE_OQ)))
+            & _mm512_cmp_ps_mask(t, T, _CMP_LT_OQ);
+
+        T = _mm512_mask_blend_ps(m, T, t);
+        O = _mm512_mask_blend_epi32(m, O, o);
+    }
+
+    float ts[16]; int32_t os[16];
+    _mm512_storeu_ps(ts, T); _mm512_storeu_si512(os, O);
+    return nearest(h, reduce(ts, os, 16));
+}
+
+#endif
+
+// spheres are culled against the packet's cone a block at a time before the
+// surviving ones are intersected with every line
+#define SCENE_BLOCK 256
+
+struct packet_t {
+    vec_t p;
+    float bx[SCENE_PACKET], by[SCENE_PACKET], bz[SCENE_PACKET];
+    float a[SCENE_PACKET], len[SCENE_PACKET];
+    vec_t axis;
+    float cos_half, sin_half;
+};
+
+inline static __attribute__((always_inline))
+void packet_spheres(const struct scene* s, const packet_t* P,
+                    size_t i0, size_t i1, float T[], int32_t O[])
+{
+    for(size_t b = i0; b < i1; b += SCENE_BLOCK) {
+        const size_t n = MIN(SCENE_BLOCK, i1 - b);
+
+        // a sphere seen at angle alpha from the axis with angular radius
+        // asin(r/d) is outside the cone when alpha > half + asin(r/d)
+        int32_t keep[SCENE_BLOCK];
+        for(size_t i = 0; i < n; i++) {
+            const float vx = s->cx[b + i] - P->p.x, vy = s->cy[b + i] - P->p.y,
+                        vz = s->cz[b + i] - P->p.z;
+            const float d2 = vx*vx + vy*vy + vz*vz, r2 = s->r2[b + i];
+            const float c = P->cos_half*sqrtf(MAX(d2 - r2, 0))
+                - P->sin_half*sqrtf(MAX(r2, 0));
+            keep[i] = d2 <= r2
+                || P->axis.x*vx + P->axis.y*vy + P->axis.z*vz >= c;
+        }
+
+        for(size_t i = 0; i < n; i++) {
+            if(!keep[i]) continue;
+
+            const float vx = s->cx[b + i] - P->p.x, vy = s->cy[b + i] - P->p.y,
+                        vz = s->cz[b + i] - P->p.z;
+            const float c = vx*vx + vy*vy + vz*vz - s->r2[b + i];
+            const int32_t k = s->sphere_object[b + i];
+            for(size_t j = 0; j < SCENE_PACKET; j++) {
+                const float B = -2*(P->bx[j]*vx + P->by[j]*vy + P->bz[j]*vz);
+                const float D = B*B - 4*P->a[j]*c;
+                const float u = (-B - sqrtf(MAX(D, 0))) / (2*P->a[j]);
+                const int m = D >= 0 && u >= 0 && u < T[j];
+                T[j] = m ? u : T[j]; O[j] = m ? k : O[j];
+            }
+        }
+    }
+}
+
+static void packet_spheres_scalar(const struct scene* s, const packet_t* P,
+                                  size_t i0, size_t i1, float T[], int32_t O[])
+{
+    packet_spheres(s, P, i0, i1, T, O);
+}
+
+#ifdef SCENE_X86
+__attribute__((target("avx2")))
+static void packet_spheres_avx(const struct scene* s, const packet_t* P,
+                               size_t i0, size_t i1, float T[], int32_t O[])
+{
+    packet_spheres(s, P, i0, i1, T, O);
+}
+
+__attribute__((target("avx512f")))
+static void packet_spheres_avx512(const struct scene* s, const packet_t* P,
+                                  size_t i0, size_t i1, float T[], int32_t O[])
+{
+    packet_spheres(s, P, i0, i1, T, O);
+}
+#endif
+
+// line coordinate where l enters the node's box or inf if it misses it, the
+// slabs' NaNs (a line on a face parallel to it) are ignored
+inline static float slab(const bvh_node_t* n, const line_t* l,
+                         const float inv[3])
+{
+    float a = (n->lo[0] - l->p.x)*inv[0], b = (n->hi[0] - l->p.x)*inv[0];
+    float tn = MIN(a, b), tf = MAX(a, b);
+    a = (n->lo[1] - l->p.y)*inv[1]; b = (n->hi[1] - l->p.y)*inv[1];
+    tn = MAX(MIN(a, b), tn); tf = MIN(MAX(a, b), tf);
+    a = (n->lo[2] - l->p.z)*inv[2]; b = (n->hi[2] - l->p.z)*inv[2];
+    tn = MAX(MIN(a, b), tn); tf = MIN(MAX(a, b), tf);
+    return tf >= MAX(tn, 0) ? tn : INFINITY;
+}
+
+typedef struct {
+    uint32_t node;
+    float t;
+} entry_t;
+
+// children are pushed far one first so that the near one is visited first
+// and its hits prune the far one
+static hit_t spheres_bvh(const struct scene* s, const line_t* l,
+                         int32_t exclude, hit_t h)
+{
+    const bvh_node_t* N = s->bvh->nodes;
+
+    // without spheres the root is an empty leaf with an empty box
+    if(s->spheres_len == 0) return h;
+
+    // small worlds fit in a single leaf
+    if(N[0].count > 0) {
+        stats.traversals += 1; stats.nodes += 1; stats.leaves += 1;
+        return s->spheres(s, l, exclude, N[0].first,
+                          N[0].first + N[0].count, h);
+    }
+
+    const float inv[3] = { 1/l->b.x, 1/l->b.y, 1/l->b.z };
+
+    entry_t stack[SCENE_STACK]; size_t sp = 0;
+    const float t = slab(&N[0], l, inv);
+    if(t < h.t) stack[sp++] = (entry_t){ .node = 0, .t = t };
+
+    size_t nodes = 0, leaves = 0;
+    while(sp > 0) {
+        const entry_t e = stack[--sp];
+        if(e.t >= h.t) continue;
+
+        const bvh_node_t* n = &N[e.node]; nodes += 1;
+        if(n->count > 0) {
+            h = s->spheres(s, l, exclude, n->first, n->first + n->count, h);
+            leaves += 1;
+            continue;
+        }
+
+        entry_t c[2] = {
+            { .node = n->first, .t = slab(&N[n->first], l, inv) },
+            { .node = n->first + 1, .t = slab(&N[n->first + 1], l, inv) },
+        };
+        if(c[1].t < c[0].t) { const entry_t x = c[0]; c[0] = c[1]; c[1] = x; }
+        if(c[1].t < h.t) stack[sp++] = c[1];
+        if(c[0].t < h.t) stack[sp++] = c[0];
+    }
+
+    stats.traversals += 1; stats.nodes += nodes; stats.leaves += leaves;
+    return h;
+}
+
+// distance from the packet's point to the node's box or inf if the box's
+// bounding sphere is outside the packet's cone
+inline static float packet_box(const packet_t* P, const bvh_node_t* n)
+{
+    const float p[3] = { P->p.x, P->p.y, P->p.z };
+    const float axis[3] = { P->axis.x, P->axis.y, P->axis.z };
+
+    float d2 = 0, v2 = 0, r2 = 0, u = 0;
+    for(size_t k = 0; k < 3; k++) {
+        const float q = MAX(MAX(n->lo[k] - p[k], p[k] - n->hi[k]), 0);
+        const float v = (n->lo[k] + n->hi[k])/2 - p[k];
+        const float r = (n->hi[k] - n->lo[k])/2;
+        d2 += q*q; v2 += v*v; r2 += r*r; u += axis[k]*v;
+    }
+
+    if(v2 > r2 && u < P->cos_half*sqrtf(v2 - r2) - P->sin_half*sqrtf(r2)) {
+        return INFINITY;
+    }
+    return sqrtf(d2);
+}
+
+// a node is skipped when it is farther from the packet's point than every
+// line's current hit
+static void packet_bvh(const struct scene* s, const packet_t* P,
+                       float T[], int32_t O[])
+{
+    const bvh_node_t* N = s->bvh->nodes;
+    if(s->spheres_len == 0) return;
+
+    entry_t stack[SCENE_STACK]; size_t sp = 0;
+    const float d = packet_box(P, &N[0]);
+    if(d < INFINITY) stack[sp++] = (entry_t){ .node = 0, .t = d };
+
+    size_t nodes = 0, leaves = 0;
+    while(sp > 0) {
+        const entry_t e = stack[--sp];
+
+        float far = 0;
+        for(size_t j = 0; j < SCENE_PACKET; j++) far = MAX(far, T[j]*P->len[j]);
+        if(e.t > far) continue;
+
+        const bvh_node_t* n = &N[e.node]; nodes += 1;
+        if(n->count > 0) {
+            s->packet(s, P, n->first, n->first + n->count, T, O);
+            leaves += 1;
+            continue;
+        }
+
+        entry_t c[2] = {
+            { .node = n->first, .t = packet_box(P, &N[n->first]) },
+            { .node = n->first + 1, .t = packet_box(P, &N[n->first + 1]) },
+        };
+        if(c[1].t < c[0].t) { const entry_t x = c[0]; c[0] = c[1]; c[1] = x; }
+        if(c[1].t < INFINITY) stack[sp++] = c[1];
+        if(c[0].t < INFINITY) stack[sp++] = c[0];
+    }
+
+    stats.traversals += 1; stats.nodes += nodes; stats.leaves += leaves;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    int r = clock_gettime(CLOCK_MONOTONIC, &ts);
+    CHECK(r, "clock_gettime");
+    return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+static size_t kernel_width(enum simd simd)
+{
+    switch(simd) {
+    case SIMD_AVX512: return 16;
+    case SIMD_AVX: return 8;
+    case SIMD_SSE: return 4;
+    default: return 1;
+    }
+}
+
+static void scene_compile_spheres(struct scene* s, const world_t* w,
+                                  size_t width)
+{
+    size_t n = 0;
+    for(size_t i = 0; i < w->objects_len; i++) {
+        n += w->objects[i].shape_type == SHAPE_TYPE_SPHERE;
+    }
+
+    float (*lo)[3] = calloc(sizeof(*lo), MAX(n, 1));
+    float (*hi)[3] = calloc(sizeof(*hi), MAX(n, 1));
+    int32_t* object = calloc(sizeof(int32_t), MAX(n, 1));
+    CHECK_IF(!lo || !hi || !object, "calloc");
+
+    for(size_t i = 0, k = 0; i < w->objects_len; i++) {
+        const object_t* o = &w->objects[i];
+        if(o->shape_type != SHAPE_TYPE_SPHERE) continue;
+
+        const sphere_t* sp = &o->shape.sphere; const float r = fabsf(sp->r);
+        lo[k][0] = sp->c.x - r; lo[k][1] = sp->c.y - r; lo[k][2] = sp->c.z - r;
+        hi[k][0] = sp->c.x + r; hi[k][1] = sp->c.y + r; hi[k][2] = sp->c.z + r;
+        object[k++] = i;
+    }
+
+    const double t0 = now_ms();
+    s->bvh = bvh_build((const float (*)[3])lo, (const float (*)[3])hi, n,
+                       width);
+    const double t1 = now_ms();
+
+    if(s->bvh->depth >= SCENE_STACK) {
+        failwith("bvh too deep: %zu", s->bvh->depth);
+    }
+
+    info("bvh: spheres=%zu nodes=%zu leaves=%zu depth=%zu slots=%zu "
+         "build=%.2fms", n, s->bvh->nodes_len, s->bvh->leaves,
+         s->bvh->depth, s->bvh->slots_len, t1 - t0);
+
+    s->spheres_len = s->bvh->slots_len;
+    s->cx = scene_alloc(s->spheres_len, sizeof(float));
+    s->cy = scene_alloc(s->spheres_len, sizeof(float));
+    s->cz = scene_alloc(s->spheres_len, sizeof(float));
+    s->r2 = scene_alloc(s->spheres_len, sizeof(float));
+    s->sphere_object = scene_alloc(s->spheres_len, sizeof(int32_t));
+
+    for(size_t i = 0; i < padded(s->spheres_len); i++) {
+        const uint32_t k = i < s->spheres_len ? s->bvh->slots[i]
+            : BVH_EMPTY_SLOT;
+        if(k == BVH_EMPTY_SLOT) {
+            s->cx[i] = s->cy[i] = s->cz[i] = 0; s->r2[i] = -INFINITY;
+            s->sphere_object[i] = -1;
+            continue;
+        }
+
+        const sphere_t* sp = &w->objects[object[k]].shape.sphere;
+        s->cx[i] = sp->c.x; s->cy[i] = sp->c.y; s->cz[i] = sp->c.z;
+        s->r2[i] = sp->r*sp->r;
+        s->sphere_object[i] = object[k];
+    }
+
+    free(lo); free(hi); free(object);
+}
+
+struct scene* scene_compile(const world_t* w, enum simd simd)
+{
+    struct scene* s = calloc(sizeof(*s), 1);
+    CHECK_IF(s == NULL, "calloc");
+
+    for(size_t i = 0; i < w->objects_len; i++) {
+        switch(w->objects[i].shape_type) {
+        case SHAPE_TYPE_SPHERE: break;
+        case SHAPE_TYPE_PLANE: s->planes_len += 1; break;
+        default: failwith("unsupported shape");
+        }
+    }
+
+    scene_compile_spheres(s, w, kernel_width(simd));
+
+    // planes are unbounded and are kept out of the hierarchy
+    s->px = scene_alloc(s->planes_len, sizeof(float));
+    s->py = scene_alloc(s->planes_len, sizeof(float));
+    s->pz = scene_alloc(s->planes_len, sizeof(float));
+    s->nx = scene_alloc(s->planes_len, sizeof(float));
+    s->ny = scene_alloc(s->planes_len, sizeof(float));
+    s->nz = scene_alloc(s->planes_len, sizeof(float));
+    s->plane_object = scene_alloc(s->planes_len, sizeof(int32_t));
+
+    for(size_t i = s->planes_len; i < padded(s->planes_len); i++) {
+        s->px[i] = s->py[i] = s->pz[i] = NAN;
+        s->nx[i] = s->ny[i] = s->nz[i] = 0;
+        s->plane_object[i] = -1;
+    }
+
+    for(size_t i = 0, l = 0; i < w->objects_len; i++) {
+        const object_t* o = &w->objects[i];
+        if(o->shape_type != SHAPE_TYPE_PLANE) continue;
+
+        const plane_t* p = &o->shape.plane;
+        s->px[l] = p->p.x; s->py[l] = p->p.y; s->pz[l] = p->p.z;
+        s->nx[l] = p->n.x; s->ny[l] = p->n.y; s->nz[l] = p->n.z;
+        s->plane_object[l++] = i;
+    }
+
+    switch(simd) {
+#ifdef SCENE_X86
+    case SIMD_AVX512:
+        s->spheres = spheres_avx512; s->planes = planes_avx512;
+        s->packet = packet_spheres_avx512;
+        break;
+    case SIMD_AVX:
+        s->spheres = spheres_avx; s->planes = planes_avx;
+        s->packet = packet_spheres_avx;
+        break;
+    case SIMD_SSE:
+        s->spheres = spheres_sse; s->planes = planes_sse;
+        s->packet = packet_spheres_scalar;
+        break;
+#endif
+    default:
+        s->spheres = spheres_scalar; s->planes = planes_scalar;
+        s->packet = packet_spheres_scalar;
+        break;
+    }
+
+    debug("scene: slots=%zu planes=%zu simd=%s",
+          s->spheres_len, s->planes_len, simd_name(simd));
+
+    return s;
+}
+
+void scene_free(struct scene* s)
+{
+    bvh_free(s->bvh);
+    free(s->cx); free(s->cy); free(s->cz); free(s->r2);
+    free(s->sphere_object);
+    free(s->px); free(s->py); free(s->pz);
+    free(s->nx); free(s->ny); free(s->nz);
+    free(s->plane_object);
+    free(s);
+}
+
+ssize_t scene_intersect(const struct scene* s, const line_t* l, float* t,
+                        ssize_t exclude)
+{
+    // the planes' hit bounds the traversal
+    hit_t h = { .t = INFINITY, .o = -1 };
+    h = s->planes(s, l, exclude, 0, s->planes_len, h);
+    h = spheres_bvh(s, l, exclude, h);
+    if(h.o >= 0 && t != NULL) *t = h.t;
+    return h.o;
+}
+
+void scene_intersect_packet(const struct scene* s, vec_t p, const vec_t b[],
+                            size_t n, float t[], ssize_t o[])
+{
+    packet_t P = { .p = p, .axis = vec(0, 0, 0) };
+
+    // unused lanes repeat the last line
+    for(size_t j = 0; j < SCENE_PACKET; j++) {
+        const vec_t c = b[MIN(j, n - 1)];
+        P.bx[j] = c.x; P.by[j] = c.y; P.bz[j] = c.z;
+        P.a[j] = norm_sq(c); P.len[j] = sqrtf(P.a[j]);
+        P.axis = add(P.axis, scalar_prod(1/P.len[j], c));
+    }
+    P.axis = normalize(P.axis);
+
+    P.cos_half = 1;
+    for(size_t j = 0; j < SCENE_PACKET; j++) {
+        P.cos_half = MIN(P.cos_half, dot(P.axis, b[MIN(j, n - 1)]) / P.len[j]);
+    }
+    P.cos_half = MAX(P.cos_half, 0);
+    P.sin_half = sqrtf(1 - P.cos_half*P.cos_half);
+
+    float T[SCENE_PACKET]; int32_t O[SCENE_PACKET];
+    for(size_t j = 0; j < SCENE_PACKET; j++) {
+        const vec_t c = b[MIN(j, n - 1)];
+        hit_t h = { .t = INFINITY, .o = -1 };
+        for(size_t i = 0; i < s->planes_len; i++) {
+            const vec_t nn = vec(s->nx[i], s->ny[i], s->nz[i]);
+            const float u = dot(sub(vec(s->px[i], s->py[i], s->pz[i]), p), nn);
+            const float v = dot(c, nn);
+            const float w = eqf(u, 0) ? 0 : u / v;
+            if(eqf(u, 0) || (!eqf(v, 0) && w >= 0)) {
+                h = nearest(h, (hit_t){ .t = w, .o = s->plane_object[i] });
+            }
+        }
+        T[j] = h.t; O[j] = h.o;
+    }
+
+    packet_bvh(s, &P, T, O);
+
+    for(size_t j = 0; j < n; j++) { t[j] = T[j]; o[j] = O[j]; }
+}
+
+void scene_stats_flush(struct scene_stats* total)
+{
+    __atomic_add_fetch(&total->traversals, stats.traversals, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->nodes, stats.nodes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total->leaves, stats.leaves, __ATOMIC_RELAXED);
+    stats = (struct scene_stats){ 0 };
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "types.h"
+#include "simd.h"
+
+// structure-of-arrays form of a world's objects: spheres are kept in the
+// leaves of a bounding volume hierarchy and planes in a separate array, both
+// are intersected several at a time
+struct scene* scene_compile(const world_t* w, enum simd simd);
+void scene_free(struct scene* s);
+
+// index of the nearest object in w->objects hit by l (excluding exclude, pass
+// -1 to consider all objects) and its line coordinate in t, or -1 if the line
+// does not hit anything
+ssize_t scene_intersect(const struct scene* s, const line_t* l, float* t,
+                        ssize_t exclude);
+
+#define SCENE_PACKET 16
+
+// nearest hits of n <= SCENE_PACKET lines sharing the point p and with
+// directions b: spheres outside the cone bounding the directions are
+// rejected for the whole packet, o[i] is -1 where line i misses
+void scene_intersect_packet(const struct scene* s, vec_t p, const vec_t b[],
+                            size_t n, float t[], ssize_t o[]);
+
+// per thread traversal counters, a traversal is a line or a packet
+struct scene_stats {
+    uint64_t traversals, nodes, leaves;
+};
+
+// adds the calling thread's counters to total and resets them
+void scene_stats_flush(struct scene_stats* total);
@@ -0,0 +1,190 @@
+#include <r.h>
+#include "sched.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+// the owner pops from the bottom, thieves steal from the top
+struct deque {
+    pthread_mutex_t lock;
+    size_t* tasks;
+    size_t top, bottom;
+};
+
+struct worker {
+    struct sched* s;
+    size_t i;
+    pthread_t thread;
+};
+
+struct sched {
+    size_t workers;
+    struct worker* ws;
+    struct deque* qs;
+    size_t capacity;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned long generation;
+    size_t running;
+    int quit;
+
+    sched_task_t f;
+    void* opaque;
+};
+
+static int deque_pop(struct deque* q, size_t* t)
+{
+    pthread_mutex_lock(&q->lock);
+    int r = q->top < q->bottom;
+    if(r) *t = q->tasks[--q->bottom];
+    pthread_mutex_unlock(&q->lock);
+    return r;
+}
+
+static int deque_steal(struct deque* q, size_t* t)
+{
+    pthread_mutex_lock(&q->lock);
+    int r = q->top < q->bottom;
+    if(r) *t = q->tasks[q->top++];
+    pthread_mutex_unlock(&q->lock);
+    return r;
+}
+
+static void sched_work(struct sched* s, size_t w)
+{
+    size_t t = 0; int found = 1;
+    while(found) {
+        while(deque_pop(&s->qs[w], &t)) {
+            s->f(t, w, s->opaque);
+        }
+
+        // tasks are never added during a run, so one unsuccessful sweep
+        // over the victims means we are done
+        found = 0;
+        for(size_t v = 1; !found && v < s->workers; v++) {
+            found = deque_steal(&s->qs[(w + v) % s->workers], &t);
+        }
+
+        if(found) s->f(t, w, s->opaque);
+    }
+}
+
+static void* sched_main(void* opaque)
+{
+    struct worker* w = opaque; struct sched* s = w->s;
+
+    unsigned long g = 0;
+    while(1) {
+        pthread_mutex_lock(&s->lock);
+        while(!s->quit && s->generation == g) {
+            pthread_cond_wait(&s->start, &s->lock);
+        }
+        g = s->generation; const int quit = s->quit;
+        pthread_mutex_unlock(&s->lock);
+
+        if(quit) return NULL;
+
+        sched_work(s, w->i);
+
+        pthread_mutex_lock(&s->lock);
+        if(--s->running == 0) pthread_cond_signal(&s->done);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+struct sched* sched_start(size_t workers)
+{
+    if(workers == 0) workers = 1;
+
+    struct sched* s = calloc(sizeof(*s), 1);
+    CHECK_IF(s == NULL, "calloc");
+
+    s->workers = workers;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->done, NULL);
+
+    s->qs = calloc(sizeof(*s->qs), workers);
+    CHECK_IF(s->qs == NULL, "calloc");
+    for(size_t i = 0; i < workers; i++) {
+        pthread_mutex_init(&s->qs[i].lock, NULL);
+    }
+
+    s->ws = calloc(sizeof(*s->ws), workers);
+    CHECK_IF(s->ws == NULL, "calloc");
+    for(size_t i = 1; i < workers; i++) {
+        s->ws[i] = (struct worker){ .s = s, .i = i };
+        int r = pthread_create(&s->ws[i].thread, NULL, sched_main, &s->ws[i]);
+        if(r != 0) { failwith("pthread_create(...) == %d", r); }
+    }
+
+    return s;
+}
+
+void sched_stop(struct sched* s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->quit = 1;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+
+    for(size_t i = 1; i < s->workers; i++) {
+        int r = pthread_join(s->ws[i].thread, NULL);
+        if(r != 0) { failwith("pthread_join(...) == %d", r); }
+    }
+
+    for(size_t i = 0; i < s->workers; i++) {
+        pthread_mutex_destroy(&s->qs[i].lock);
+        free(s->qs[i].tasks);
+    }
+
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->start);
+    pthread_mutex_destroy(&s->lock);
+
+    free(s->qs); free(s->ws); free(s);
+}
+
+size_t sched_workers(const struct sched* s)
+{
+    return s->workers;
+}
+
+void sched_run(struct sched* s, size_t tasks, sched_task_t f, void* opaque)
+{
+    if(tasks > s->capacity) {
+        for(size_t i = 0; i < s->workers; i++) {
+            free(s->qs[i].tasks);
+            s->qs[i].tasks = calloc(sizeof(size_t), tasks);
+            CHECK_IF(s->qs[i].tasks == NULL, "calloc");
+        }
+        s->capacity = tasks;
+    }
+
+    // deal out contiguous runs of tasks so neighbouring tiles start out on
+    // the same worker
+    for(size_t i = 0; i < s->workers; i++) {
+        struct deque* q = &s->qs[i];
+        const size_t a = i*tasks/s->workers, b = (i + 1)*tasks/s->workers;
+        q->top = 0; q->bottom = b - a;
+        for(size_t t = a; t < b; t++) {
+            q->tasks[b - 1 - t] = t;
+        }
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->f = f; s->opaque = opaque;
+    s->running = s->workers - 1;
+    s->generation += 1;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+
+    sched_work(s, 0);
+
+    pthread_mutex_lock(&s->lock);
+    while(s->running > 0) {
+        pthread_cond_wait(&s->done, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
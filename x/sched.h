@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+struct sched;
+
+typedef void (*sched_task_t)(size_t task, size_t worker, void* opaque);
+
+struct sched* sched_start(size_t workers);
+void sched_stop(struct sched* s);
+
+size_t sched_workers(const struct sched* s);
+
+// runs f on each of the tasks [0, tasks) and returns when all are done,
+// the calling thread participates as worker 0
+void sched_run(struct sched* s, size_t tasks, sched_task_t f, void* opaque);
@@ -0,0 +1,38 @@
+#include <r.h>
+#include "simd.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* names[] = {
+    [SIMD_SCALAR] = "scalar",
+    [SIMD_SSE] = "sse",
+    [SIMD_AVX] = "avx",
+    [SIMD_AVX512] = "avx512",
+};
+
+const char* simd_name(enum simd s)
+{
+    return names[s];
+}
+
+enum simd simd_detect(void)
+{
+    enum simd s = SIMD_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) s = SIMD_SSE;
+    if(__builtin_cpu_supports("avx2")) s = SIMD_AVX;
+    if(__builtin_cpu_supports("avx512f")) s = SIMD_AVX512;
+#endif
+
+    const char* e = getenv("RT_SIMD");
+    if(e != NULL) {
+        enum simd c = SIMD_SCALAR;
+        while(c < LENGTH(names) && strcmp(e, names[c]) != 0) c++;
+        if(c == LENGTH(names)) { failwith("unknown RT_SIMD: %s", e); }
+        s = MIN(s, c);
+    }
+
+    return s;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+enum simd {
+    SIMD_SCALAR,
+    SIMD_SSE,
+    SIMD_AVX,
+    SIMD_AVX512,
+};
+
+// widest instruction set supported by the cpu, capped by RT_SIMD
+// (scalar, sse, avx or avx512) when set
+enum simd simd_detect(void);
+
+const char* simd_name(enum simd s);
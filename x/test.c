@@ -0,0 +1,9 @@
+#include <r.h>
+#include "rt.h"
+
+int main(int argc, char** argv)
+{
+    rt_setup();
+    rt_tests();
+    return 0;
+}
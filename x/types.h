@@ -0,0 +1,145 @@
+#pragma once
+
+#include "rt.h"
+
+#include <math.h>
+#include <stdint.h>
+
+typedef struct {
+    float x, y, z;
+} vec_t;
+
+#define vec(x, y, z) ((vec_t){ x, y, z })
+
+// p + span(b)
+typedef struct {
+    vec_t p;
+    vec_t b;
+} line_t;
+
+// forall v: (v - p) . n = 0
+typedef struct {
+    vec_t p;
+    vec_t n;
+} plane_t;
+
+// p + span(b_0, b_1)
+typedef struct {
+    vec_t p;
+    vec_t b[2];
+} grid_t;
+
+// |v - c| = r
+typedef struct {
+    vec_t c;
+    float r;
+} sphere_t;
+
+inline static __attribute__((always_inline))
+vec_t add(vec_t v, vec_t w)
+{
+    return (vec_t){ .x = v.x + w.x, .y = v.y + w.y, .z = v.z + w.z };
+}
+
+inline static __attribute__((always_inline))
+vec_t sub(vec_t v, vec_t w)
+{
+    return (vec_t){ .x = v.x - w.x, .y = v.y - w.y, .z = v.z - w.z };
+}
+
+inline static __attribute__((always_inline))
+float dot(vec_t v, vec_t w)
+{
+    return v.x*w.x + v.y*w.y + v.z*w.z;
+}
+
+inline static __attribute__((always_inline))
+vec_t cross(vec_t a, vec_t b)
+{
+    return vec(a.y*b.z - a.z*b.y, - (a.x*b.z - a.z*b.x), a.x*b.y - a.y*b.x);
+}
+
+inline static __attribute__((always_inline))
+float norm_sq(vec_t v)
+{
+    return v.x*v.x + v.y*v.y + v.z*v.z;
+}
+
+inline static __attribute__((always_inline))
+float norm(vec_t v)
+{
+    return sqrtf(norm_sq(v));
+}
+
+inline static __attribute__((always_inline))
+vec_t scalar_prod(float t, vec_t v)
+{
+    return (vec_t){ .x = t * v.x, .y = t * v.y, .z = t * v.z};
+}
+
+inline static __attribute__((always_inline))
+vec_t normalize(vec_t v)
+{
+    return scalar_prod(1/norm(v), v);
+}
+
+inline static __attribute__((always_inline))
+line_t line_from_two_points(vec_t v, vec_t w)
+{
+    return (line_t){ .p = v, .b = sub(w, v) };
+}
+
+
+
+inline static __attribute__((always_inline))
+vec_t grid_coord(grid_t g, float s, float t)
+{
+    return vec(
+        g.p.x + s*g.b[0].x + t*g.b[1].x,
+        g.p.y + s*g.b[0].y + t*g.b[1].y,
+        g.p.z + s*g.b[0].z + t*g.b[1].z
+    );
+}
+
+inline static __attribute__((always_inline))
+vec_t line_coord(line_t l, float t)
+{
+    return add(l.p, scalar_prod(t, l.b));
+}
+
+#define eqf(a,b) (fabsf(a - b) < 1e-8)
+
+typedef struct {
+    color_t color;
+    color_t light;
+    float dispersion;
+} material_t;
+
+typedef enum {
+    SHAPE_TYPE_SPHERE,
+    SHAPE_TYPE_PLANE,
+} shape_type_t;
+
+typedef struct {
+    union {
+        uint64_t seed;
+        unsigned int id;
+    } unique;
+
+    shape_type_t shape_type;
+    union {
+        sphere_t sphere;
+        plane_t plane;
+    } shape;
+    material_t material;
+} object_t;
+
+struct scene;
+
+typedef struct {
+    object_t* objects;
+    size_t objects_len;
+
+    // compiled form of objects, see scene.h
+    struct scene* scene;
+} world_t;